@@ -0,0 +1,192 @@
+#include "precomp.h"
+#include "Accumulator.h"
+
+// IEEE 754 binary16 conversion with round to nearest even, radiance is never NaN
+static uint16_t FloatToHalf(const float value)
+{
+	uint bits;
+	memcpy(&bits, &value, 4);
+	const uint sign = (bits >> 16) & 0x8000;
+	const int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	uint mantissa = bits & 0x7fffff;
+
+	if (exponent >= 31) return (uint16_t)(sign | 0x7bff); // saturate, an infinity would never average out again
+	if (exponent <= 0)
+	{
+		// Subnormal or zero
+		if (exponent < -10) return (uint16_t)sign;
+		mantissa |= 0x800000;
+		const int shift = 14 - exponent;
+		uint half = mantissa >> shift;
+		const uint rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1))) half++;
+		return (uint16_t)(sign | half);
+	}
+
+	uint half = ((uint)exponent << 10) | (mantissa >> 13);
+	const uint rest = mantissa & 0x1fff;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++; // may carry into the exponent, which is still correct
+	return (uint16_t)(sign | min(half, 0x7bffu));
+}
+
+// Rounds to one of the two halves around value, up with a probability of how far value is towards it, so the
+// expected half is value itself: random bits are added below the ones the conversion drops, then truncated
+static uint16_t FloatToHalfStochastic(const float value, const uint random)
+{
+	uint bits;
+	memcpy(&bits, &value, 4);
+	const uint sign = (bits >> 16) & 0x8000;
+	const int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	if (exponent >= 31) return (uint16_t)(sign | 0x7bff);
+	if (exponent <= 0)
+	{
+		// Subnormal or zero
+		if (exponent < -10) return (uint16_t)sign;
+		const int shift = 14 - exponent;
+		return (uint16_t)(sign | ((((bits & 0x7fffff) | 0x800000) + (random & ((1u << shift) - 1))) >> shift));
+	}
+
+	// A carry into the exponent is still the right half
+	const uint rounded = (bits & 0x7fffffff) + (random & 0x1fff);
+	const uint half = ((((rounded >> 23) & 0xff) - 127 + 15) << 10) | ((rounded & 0x7fffff) >> 13);
+	return (uint16_t)(sign | min(half, 0x7bffu));
+}
+
+static float HalfToFloat(const uint16_t half)
+{
+	const uint sign = (uint)(half & 0x8000) << 16;
+	const int exponent = (half >> 10) & 0x1f;
+	const uint mantissa = half & 0x3ff;
+
+	uint bits;
+	if (exponent == 0)
+	{
+		// Subnormals are mantissa * 2^-24
+		const float value = mantissa * (1.f / 16777216.f);
+		return sign ? -value : value;
+	}
+	if (exponent == 31) bits = sign | 0x7f800000 | (mantissa << 13);
+	else bits = sign | ((uint)(exponent - 15 + 127) << 23) | (mantissa << 13);
+	float value;
+	memcpy(&value, &bits, 4);
+	return value;
+}
+
+// Shared exponent encoding of EXT_texture_shared_exponent: 9-bit mantissas, 5-bit exponent with bias 15.
+// A mantissa rounds up once its fraction passes 1 - offset: 0.5 rounds to nearest, a uniform random offset
+// rounds stochastically.
+static uint PackRGB9E5(const float3& color, const float3& offset = float3(0.5f))
+{
+	constexpr int mantissaBits = 9, bias = 15, maxExponent = 31;
+	constexpr float maxValue = (float)((1 << mantissaBits) - 1) / (1 << mantissaBits) * (float)(1 << (maxExponent - bias));
+	const float red = clamp(color.x, 0.f, maxValue), green = clamp(color.y, 0.f, maxValue), blue = clamp(color.z, 0.f, maxValue);
+	const float largest = max(red, max(green, blue));
+	if (largest <= 0.f) return 0;
+
+	int exponent = max(-bias - 1, (int)floorf(log2f(largest))) + 1 + bias;
+	float scale = exp2f((float)(exponent - bias - mantissaBits));
+	if ((int)floorf(largest / scale + max(offset.x, max(offset.y, offset.z))) >= (1 << mantissaBits)) exponent++, scale *= 2.f;
+
+	const uint rm = (uint)floorf(red / scale + offset.x), gm = (uint)floorf(green / scale + offset.y), bm = (uint)floorf(blue / scale + offset.z);
+	return rm | (gm << 9) | (bm << 18) | ((uint)exponent << 27);
+}
+
+static float3 UnpackRGB9E5(const uint packed)
+{
+	const float scale = exp2f((float)((int)(packed >> 27) - 15 - 9));
+	return float3((packed & 0x1ff) * scale, ((packed >> 9) & 0x1ff) * scale, ((packed >> 18) & 0x1ff) * scale);
+}
+
+void Accumulator::Resize(const int pixelCount, const AccumulatorFormat newFormat)
+{
+	pixels = pixelCount, format = newFormat;
+	frames.assign(pixels, 0);
+
+	// Only the active format holds memory
+	auto size = [&](AccumulatorFormat f) { return f == format ? pixels : 0; };
+	rgba.assign(size(AccumulatorFormat::FLOAT4), float4(0.f));
+	r.assign(size(AccumulatorFormat::FLOAT3), 0.f), g.assign(size(AccumulatorFormat::FLOAT3), 0.f), b.assign(size(AccumulatorFormat::FLOAT3), 0.f);
+	r16.assign(size(AccumulatorFormat::HALF), 0), g16.assign(size(AccumulatorFormat::HALF), 0), b16.assign(size(AccumulatorFormat::HALF), 0);
+	rgb9e5.assign(size(AccumulatorFormat::RGB9E5), 0);
+	for (std::vector<float>* plane : { &r, &g, &b }) plane->shrink_to_fit();
+	for (std::vector<uint16_t>* plane : { &r16, &g16, &b16 }) plane->shrink_to_fit();
+	rgba.shrink_to_fit(), rgb9e5.shrink_to_fit();
+}
+
+void Accumulator::Clear()
+{
+	// Zero is zero in every format
+	std::fill(frames.begin(), frames.end(), (uint16_t)0);
+	std::fill(rgba.begin(), rgba.end(), float4(0.f));
+	for (std::vector<float>* plane : { &r, &g, &b }) std::fill(plane->begin(), plane->end(), 0.f);
+	for (std::vector<uint16_t>* plane : { &r16, &g16, &b16 }) std::fill(plane->begin(), plane->end(), (uint16_t)0);
+	std::fill(rgb9e5.begin(), rgb9e5.end(), 0u);
+}
+
+int Accumulator::BytesPerPixel() const
+{
+	const int counter = sizeof(uint16_t);
+	switch (format)
+	{
+	case AccumulatorFormat::FLOAT4: return 16 + counter;
+	case AccumulatorFormat::FLOAT3: return 12 + counter;
+	case AccumulatorFormat::HALF: return 6 + counter;
+	default: return 4 + counter;
+	}
+}
+
+const char* Accumulator::FormatName(const AccumulatorFormat format)
+{
+	switch (format)
+	{
+	case AccumulatorFormat::FLOAT4: return "float4";
+	case AccumulatorFormat::FLOAT3: return "float planes";
+	case AccumulatorFormat::HALF: return "half planes";
+	default: return "rgb9e5";
+	}
+}
+
+float4 Accumulator::Average(const int pixel) const
+{
+	switch (format)
+	{
+	case AccumulatorFormat::FLOAT4: return rgba[pixel];
+	case AccumulatorFormat::FLOAT3: return float4(r[pixel], g[pixel], b[pixel], 0.f);
+	case AccumulatorFormat::HALF: return float4(HalfToFloat(r16[pixel]), HalfToFloat(g16[pixel]), HalfToFloat(b16[pixel]), 0.f);
+	default: return float4(UnpackRGB9E5(rgb9e5[pixel]), 0.f);
+	}
+}
+
+void Accumulator::Set(const int pixel, const float3& average, const int frameCount)
+{
+	frames[pixel] = (uint16_t)clamp(frameCount, 0, MAXFRAMES);
+	switch (format)
+	{
+	case AccumulatorFormat::FLOAT4: rgba[pixel] = float4(average, 0.f); break;
+	case AccumulatorFormat::FLOAT3: r[pixel] = average.x, g[pixel] = average.y, b[pixel] = average.z; break;
+	case AccumulatorFormat::HALF: r16[pixel] = FloatToHalf(average.x), g16[pixel] = FloatToHalf(average.y), b16[pixel] = FloatToHalf(average.z); break;
+	default: rgb9e5[pixel] = PackRGB9E5(average); break;
+	}
+}
+
+float4 Accumulator::Add(const int pixel, const float3& value)
+{
+	// Incremental mean; past MAXFRAMES every frame keeps the weight of the last one
+	const int count = min((int)frames[pixel] + 1, MAXFRAMES);
+	const float4 previous = Average(pixel);
+	const float3 average = float3(previous.x, previous.y, previous.z) + (value - float3(previous.x, previous.y, previous.z)) * (1.f / count);
+	if (format == AccumulatorFormat::FLOAT4 || format == AccumulatorFormat::FLOAT3)
+	{
+		Set(pixel, average, count);
+		return Average(pixel);
+	}
+
+	// Rounded to nearest, the packed formats would drop every correction below half a step and keep the rare large
+	// ones, and drift. Rounded stochastically, every correction lands in expectation.
+	uint seed = InitSeed((uint)pixel * 65537u + (uint)count);
+	frames[pixel] = (uint16_t)count;
+	if (format == AccumulatorFormat::HALF)
+		r16[pixel] = FloatToHalfStochastic(average.x, RandomUInt(seed)), g16[pixel] = FloatToHalfStochastic(average.y, RandomUInt(seed)), b16[pixel] = FloatToHalfStochastic(average.z, RandomUInt(seed));
+	else rgb9e5[pixel] = PackRGB9E5(average, float3(RandomFloat(seed), RandomFloat(seed), RandomFloat(seed)));
+	return Average(pixel);
+}
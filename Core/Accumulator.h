@@ -0,0 +1,43 @@
+#pragma once
+
+// Storage layout of the accumulated radiance
+enum class AccumulatorFormat
+{
+	FLOAT4, // float4 per pixel (16 B)
+	FLOAT3, // three float planes (12 B)
+	HALF, // three fp16 planes (6 B)
+	RGB9E5, // 9-bit mantissas with a shared 5-bit exponent (4 B)
+};
+
+// Running per-pixel average of the traced frames plus a 16-bit frame counter.
+// The average is stored instead of the sum, so the packed formats keep their relative precision
+// however many frames are accumulated. Their updates round stochastically: a frame that moves the
+// average by less than the format can resolve still moves it in expectation, so they converge to the
+// float average instead of dropping small corrections.
+class Accumulator
+{
+public:
+	static constexpr int MAXFRAMES = 65535;
+
+	void Resize(const int pixelCount, const AccumulatorFormat format);
+	void Clear();
+
+	AccumulatorFormat Format() const { return format; }
+	int BytesPerPixel() const; // radiance and frame counter
+	static const char* FormatName(const AccumulatorFormat format);
+
+	int Frames(const int pixel) const { return frames[pixel]; }
+	float4 Average(const int pixel) const;
+	void Set(const int pixel, const float3& average, const int frameCount);
+	// Folds one more frame into the average and returns the new average
+	float4 Add(const int pixel, const float3& value);
+
+private:
+	AccumulatorFormat format = AccumulatorFormat::FLOAT4;
+	int pixels = 0;
+	std::vector<uint16_t> frames;
+	std::vector<float4> rgba; // FLOAT4
+	std::vector<float> r, g, b; // FLOAT3
+	std::vector<uint16_t> r16, g16, b16; // HALF
+	std::vector<uint> rgb9e5; // RGB9E5
+};
@@ -0,0 +1,63 @@
+#include "precomp.h"
+#include "AliasTable.h"
+
+// Largest float below 1, keeps a remapped random number in [0, 1)
+static const float oneMinusEpsilon = 0.99999994f;
+
+bool AliasTable::Update(const std::vector<float>& newWeights)
+{
+	if (newWeights == weights && !columns.empty()) return false;
+	Build(newWeights);
+	return true;
+}
+
+void AliasTable::Build(const std::vector<float>& newWeights)
+{
+	weights = newWeights;
+	const int n = (int)weights.size();
+	columns.assign(n, Column{ 1.f, -1, 0.f });
+	total = 0.f;
+	for (const float weight : weights) total += max(weight, 0.f);
+	if (total <= 0.f) return;
+
+	// Scaled so the average outcome fills exactly one column
+	std::vector<double> scaled(n);
+	std::vector<int> under, over;
+	for (int i = 0; i < n; i++)
+	{
+		columns[i].pmf = max(weights[i], 0.f) / total;
+		scaled[i] = (double)columns[i].pmf * n;
+		(scaled[i] < 1.0 ? under : over).push_back(i);
+	}
+
+	// Top up every column that is short with the excess of one that has too much
+	while (!under.empty() && !over.empty())
+	{
+		const int small = under.back(), large = over.back();
+		under.pop_back(), over.pop_back();
+		columns[small].threshold = (float)scaled[small], columns[small].alias = large;
+		scaled[large] -= 1.0 - scaled[small];
+		(scaled[large] < 1.0 ? under : over).push_back(large);
+	}
+
+	// What is left is 1 up to rounding
+	for (const int i : under) columns[i].threshold = 1.f, columns[i].alias = -1;
+	for (const int i : over) columns[i].threshold = 1.f, columns[i].alias = -1;
+}
+
+int AliasTable::Sample(const float u, float& pmf, float* remapped) const
+{
+	pmf = 0.f;
+	if (Empty()) return -1;
+
+	const int n = (int)columns.size();
+	const int column = min((int)(u * n), n - 1);
+	const float within = min(u * n - column, oneMinusEpsilon);
+	const Column& entry = columns[column];
+	const bool own = within < entry.threshold || entry.alias < 0;
+	const int index = own ? column : entry.alias;
+	if (remapped) *remapped = own ? min(within / entry.threshold, oneMinusEpsilon) : min((within - entry.threshold) / (1.f - entry.threshold), oneMinusEpsilon);
+
+	pmf = columns[index].pmf;
+	return index;
+}
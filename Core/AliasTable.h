@@ -0,0 +1,30 @@
+#pragma once
+
+// Picks one of N outcomes in proportion to their weights in O(1), with Vose's alias method: every
+// outcome owns a column of equal probability, split between itself and one alias outcome.
+class AliasTable
+{
+public:
+	// Rebuilds when the weights differ from the ones the table was built from, returns whether it did
+	bool Update(const std::vector<float>& newWeights);
+	void Build(const std::vector<float>& newWeights);
+	bool Empty() const { return total <= 0.f; }
+	int Size() const { return (int)columns.size(); }
+	float Pmf(const int index) const { return columns[index].pmf; }
+
+	// Outcome for random number u, -1 when every weight is 0. remapped receives a fresh number in [0, 1)
+	// made from what u has left after picking the outcome
+	int Sample(const float u, float& pmf, float* remapped = nullptr) const;
+
+private:
+	struct Column
+	{
+		float threshold; // share of the column that picks its own outcome, the rest picks the alias
+		int alias;
+		float pmf;
+	};
+
+	std::vector<float> weights;
+	std::vector<Column> columns;
+	float total = 0.f;
+};
@@ -25,6 +25,7 @@ AreaLight::AreaLight(std::string fileName, std::string sceneName, bool exists)
         filesystem::copy_file(resourcesPath + ".json",
             finalPath + ".json", filesystem::copy_options::overwrite_existing);
 
+        LoadShape();
         transform = new LightTransform(finalPath + ".json");
     }
 
@@ -33,8 +34,10 @@ AreaLight::AreaLight(std::string fileName, std::string sceneName, bool exists)
         name = fileName;
         finalPath = "../assets/" + sceneName + "/arealights/" + name;
 
+        LoadShape();
         transform = new LightTransform(finalPath + ".json");
     }
+    SaveShape();
 }
 
 AreaLight::~AreaLight()
@@ -42,16 +45,34 @@ AreaLight::~AreaLight()
 
 }
 
-float3 AreaLight::RandomPointOnLight()
+float3 AreaLight::Normal() const
 {
-	float3 finalSample{};
+	const float3 axis = transform->rotation;
+	return dot(axis, axis) > 0.f ? -normalize(axis) : float3(0.f, -1.f, 0.f); // without a rotation it shines down
+}
 
-	for (int i = 0; i <= samples; i++)
-	{
-		finalSample += float3(RandomFloat() - 1, 3, RandomFloat() - 1);
-	}
+float AreaLight::Area() const
+{
+	return shape == SHAPES::DISK ? PI * size.x * size.x : size.x * size.y;
+}
 
-	return finalSample / static_cast<float>(samples);
+float3 AreaLight::PointOnLight(const float u, const float v) const
+{
+	// Tangent frame around the normal, the width runs along the horizontal tangent whenever there is one
+	const float3 normal = Normal();
+	const float3 tangent = normalize(cross(fabsf(normal.y) < 0.999f ? float3(0.f, 1.f, 0.f) : float3(1.f, 0.f, 0.f), normal));
+	const float3 bitangent = cross(normal, tangent);
+
+	if (shape == SHAPES::RECTANGLE)
+		return transform->position + tangent * ((u - 0.5f) * size.x) + bitangent * ((v - 0.5f) * size.y);
+
+	// Concentric mapping (Shirley and Chiu), keeps the strata of the square compact on the disk
+	const float a = 2.f * u - 1.f, b = 2.f * v - 1.f;
+	if (a == 0.f && b == 0.f) return transform->position;
+	float radius, phi;
+	if (fabsf(a) > fabsf(b)) radius = a, phi = 0.25f * PI * (b / a);
+	else radius = b, phi = 0.5f * PI - 0.25f * PI * (a / b);
+	return transform->position + (tangent * cosf(phi) + bitangent * sinf(phi)) * (radius * size.x);
 }
 
 void AreaLight::Reset()
@@ -70,4 +91,36 @@ void AreaLight::DeleteData()
 void AreaLight::Update()
 {
     transform->Update();
+    SaveShape();
+}
+
+void AreaLight::LoadShape()
+{
+	std::ifstream jsonIn(finalPath + ".json");
+	json data = json::parse(jsonIn);
+	if (data.contains("shape")) shape = data["shape"].get<std::string>() == "disk" ? SHAPES::DISK : SHAPES::RECTANGLE;
+	if (data.contains("sX")) size.x = data["sX"].get<float>();
+	if (data.contains("sY")) size.y = data["sY"].get<float>();
+	if (data.contains("samples")) samples = data["samples"].get<int>();
+	if (samples < 1 || samples > AREALIGHTSAMPLES)
+	{
+		std::cerr << "Area light " << finalPath << ": " << samples << " samples, using " << clamp(samples, 1, AREALIGHTSAMPLES) << " (1 to " << AREALIGHTSAMPLES << ")" << std::endl;
+		samples = clamp(samples, 1, AREALIGHTSAMPLES);
+	}
+}
+
+void AreaLight::SaveShape()
+{
+	json data;
+	{
+		std::ifstream jsonIn(finalPath + ".json");
+		data = json::parse(jsonIn);
+	}
+	data["shape"] = shape == SHAPES::DISK ? "disk" : "rectangle";
+	data["sX"] = size.x;
+	data["sY"] = size.y;
+	data["samples"] = samples;
+
+	std::ofstream jsonOut(finalPath + ".json");
+	jsonOut << std::setw(4) << data;
 }
\ No newline at end of file
@@ -1,26 +1,38 @@
 #pragma once
 #include "LightTransform.h"
 
+// One-sided emitter shaped as a rectangle or a disk, facing away from its rotation like a spot light. It is not
+// part of the scene's geometry, so only light sampling sees it: its soft shadows come from shadow rays to points
+// spread over its surface
 class AreaLight
 {
 public:
 	AreaLight(std::string fileName, std::string sceneName, bool exists = false);
 	~AreaLight();
 
-	int samples = 5;
+	enum class SHAPES { RECTANGLE, DISK };
+	SHAPES shape = SHAPES::RECTANGLE;
+	float2 size{ 0.1f, 0.1f }; // Width and height of a rectangle, x is the radius of a disk
+
+	int samples = 4; // Shadow rays per light sample, stratified over the surface
 
 	std::string name;
 	std::string finalPath;
 	std::string resourcesPath;
 	std::string prefabName;
 
-	LightTransform* transform;
+	LightTransform* transform; // color is the radiance leaving the front face
 
-	float3 RandomPointOnLight();
+	// Point on the light for a 2D sample in [0, 1), area preserving so uniform samples cover the surface uniformly
+	float3 PointOnLight(const float u, const float v) const;
+	float3 Normal() const; // Direction the front face emits towards
+	float Area() const;
 
 	void Reset();
 	void DeleteData();
 	void Update();
 
 private:
+	void LoadShape(); // shape and size sit in the JSON next to the transform, which does not know them
+	void SaveShape();
 };
\ No newline at end of file
@@ -348,7 +348,7 @@ float BRDF::specularSampleWeightGGXWalter(float alpha, float alphaSquared, float
 #endif
 }
 
-float3 BRDF::sampleSpecularMicrofacet(float3 Vlocal, float alpha, float alphaSquared, float3 specularF0, float2 u, float3 weight)
+float3 BRDF::sampleSpecularMicrofacet(float3 Vlocal, float alpha, float alphaSquared, float3 specularF0, float2 u, float3& weight)
 {
 
 	// Sample a microfacet normal (H) in local space
@@ -451,6 +451,19 @@ float3 BRDF::evalCombinedBRDF(float3 N, float3 L, float3 V, MaterialProperties m
 	return (float3(1.0f, 1.0f, 1.0f) - data.F) * diffuse + specular;
 }
 
+void BRDF::evalCombinedBRDFLobes(float3 N, float3 L, float3 V, MaterialProperties material, float3& diffuse, float3& specular)
+{
+	const BrdfData data = prepareBRDFData(N, L, V, material);
+	if (data.Vbackfacing || data.Lbackfacing)
+	{
+		diffuse = specular = float3(0.0f, 0.0f, 0.0f);
+		return;
+	}
+
+	diffuse = (float3(1.0f, 1.0f, 1.0f) - data.F) * evalDiffuse(data);
+	specular = evalSpecular(data);
+}
+
 bool BRDF::evalIndirectCombinedBRDF(float2 u, float3 shadingNormal, float3 geometryNormal, float3 V, MaterialProperties material, const int brdfType, float3& rayDirection, float3& sampleWeight)
 {
 	UNREFERENCED_PARAMETER(geometryNormal);
@@ -501,6 +514,19 @@ bool BRDF::evalIndirectCombinedBRDF(float2 u, float3 shadingNormal, float3 geome
 	return true;
 }
 
+float BRDF::evalIndirectPdf(float3 N, float3 L, float3 V, MaterialProperties material, const int brdfType)
+{
+	const BrdfData data = prepareBRDFData(N, L, V, material);
+	if (data.Vbackfacing || data.Lbackfacing) return 0.0f;
+
+	// Cosine-weighted hemisphere
+	if (brdfType == DIFFUSE_TYPE) return data.NdotL * ONE_OVER_PI;
+
+	// Zero roughness always reflects about N, no other direction can be sampled
+	if (data.alpha == 0.0f) return 0.0f;
+	return specularPdf(data.alpha, data.alphaSquared, data.NdotH, data.NdotV, data.LdotH);
+}
+
 float BRDF::getBrdfProbability(MaterialProperties material, float3 V, float3 shadingNormal)
 {
 	// Compute specular reflectance at normal incidence (F0) based on material properties
@@ -348,7 +348,7 @@ public:
 
 	// Samples a reflection ray from the rough surface using selected microfacet distribution and sampling method
 	// Resulting weight includes multiplication by cosine (NdotL) term
-	 float3 sampleSpecularMicrofacet(float3 Vlocal, float alpha, float alphaSquared, float3 specularF0, float2 u, float3 weight);
+	 float3 sampleSpecularMicrofacet(float3 Vlocal, float alpha, float alphaSquared, float3 specularF0, float2 u, float3& weight);
 
 	// Evaluates microfacet specular BRDF
 	float3 evalMicrofacet(const BrdfData data);
@@ -358,9 +358,15 @@ public:
 	// This is an entry point for evaluation of all other BRDFs based on selected configuration (for direct light)
 	float3 evalCombinedBRDF(float3 N, float3 L, float3 V, MaterialProperties material);
 
+	// evalCombinedBRDF split into its diffuse and specular parts, so each can be weighed against the lobe that samples it
+	void evalCombinedBRDFLobes(float3 N, float3 L, float3 V, MaterialProperties material, float3& diffuse, float3& specular);
+
 	// This is an entry point for evaluation of all other BRDFs based on selected configuration (for indirect light)
 	bool evalIndirectCombinedBRDF(float2 u, float3 shadingNormal, float3 geometryNormal, float3 V, MaterialProperties material, const int brdfType, float3& rayDirection, float3& sampleWeight);
 
+	// Solid angle PDF with which evalIndirectCombinedBRDF picks direction L for the given lobe, 0 for a perfect (delta) reflection
+	float evalIndirectPdf(float3 N, float3 L, float3 V, MaterialProperties material, const int brdfType);
+
 	float getBrdfProbability(MaterialProperties material, float3 V, float3 shadingNormal);
 
 	float3 srgbToLinear(float3 c);
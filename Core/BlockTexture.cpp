@@ -0,0 +1,201 @@
+#include "precomp.h"
+#include "BlockTexture.h"
+
+// 565 color expanded to 8 bits per channel, packed as 0xRRGGBB
+static uint Expand565(const uint c)
+{
+	const uint r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+}
+
+static uint Quantize565(const float3& c)
+{
+	const uint r = (uint)(clamp(c.x, 0.f, 255.f) * 31.f / 255.f + 0.5f);
+	const uint g = (uint)(clamp(c.y, 0.f, 255.f) * 63.f / 255.f + 0.5f);
+	const uint b = (uint)(clamp(c.z, 0.f, 255.f) * 31.f / 255.f + 0.5f);
+	return r << 11 | g << 5 | b;
+}
+
+// The four colors of a BC1 block; with c0 <= c1 the block has three and black
+static void PaletteBC1(const uint c0, const uint c1, uint palette[4])
+{
+	palette[0] = Expand565(c0), palette[1] = Expand565(c1);
+	for (int shift = 0; shift < 24; shift += 8)
+	{
+		const uint a = (palette[0] >> shift) & 255, b = (palette[1] >> shift) & 255;
+		if (c0 > c1)
+		{
+			palette[2] |= ((2 * a + b + 1) / 3) << shift;
+			palette[3] |= ((a + 2 * b + 1) / 3) << shift;
+		}
+		else palette[2] |= ((a + b + 1) / 2) << shift;
+	}
+}
+
+// The eight values of a BC4 block; with a0 <= a1 it has six, 0 and 255
+static void PaletteBC4(const uint a0, const uint a1, uint palette[8])
+{
+	palette[0] = a0, palette[1] = a1;
+	if (a0 > a1)
+		for (int i = 1; i < 7; i++) palette[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+	else
+	{
+		for (int i = 1; i < 5; i++) palette[i + 1] = ((5 - i) * a0 + i * a1 + 2) / 5;
+		palette[6] = 0, palette[7] = 255;
+	}
+}
+
+// Endpoints along the block's principal axis, found by power iteration on the color covariance, and every
+// texel's nearest color of the palette they make
+static uint64_t EncodeBC1(const uint texels[16])
+{
+	float3 colors[16], mean(0.f);
+	for (int i = 0; i < 16; i++)
+	{
+		colors[i] = float3((float)((texels[i] >> 16) & 255), (float)((texels[i] >> 8) & 255), (float)(texels[i] & 255));
+		mean += colors[i] * (1.f / 16.f);
+	}
+	float covariance[6] = {};
+	for (const float3& c : colors)
+	{
+		const float3 d = c - mean;
+		covariance[0] += d.x * d.x, covariance[1] += d.x * d.y, covariance[2] += d.x * d.z;
+		covariance[3] += d.y * d.y, covariance[4] += d.y * d.z, covariance[5] += d.z * d.z;
+	}
+	float3 axis(1.f, 1.f, 1.f);
+	for (int i = 0; i < 4; i++)
+	{
+		axis = float3(covariance[0] * axis.x + covariance[1] * axis.y + covariance[2] * axis.z,
+			covariance[1] * axis.x + covariance[3] * axis.y + covariance[4] * axis.z,
+			covariance[2] * axis.x + covariance[4] * axis.y + covariance[5] * axis.z);
+		const float length = sqrtf(dot(axis, axis));
+		if (length < 1e-6f) break;
+		axis = axis * (1.f / length);
+	}
+	if (dot(axis, axis) < 0.5f) axis = float3(0.f); // flat block, both endpoints are the mean
+	float lowest = 0.f, highest = 0.f;
+	for (const float3& c : colors)
+	{
+		const float t = dot(c - mean, axis);
+		lowest = min(lowest, t), highest = max(highest, t);
+	}
+
+	uint c0 = Quantize565(mean + axis * highest), c1 = Quantize565(mean + axis * lowest);
+	if (c0 < c1) std::swap(c0, c1);
+	uint64_t block = (uint64_t)c0 | (uint64_t)c1 << 16;
+	if (c0 == c1) return block; // every index 0
+
+	uint palette[4] = {};
+	PaletteBC1(c0, c1, palette);
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, bestError = INT_MAX;
+		for (int p = 0; p < 4; p++)
+		{
+			const int dr = (int)((palette[p] >> 16) & 255) - (int)((texels[i] >> 16) & 255);
+			const int dg = (int)((palette[p] >> 8) & 255) - (int)((texels[i] >> 8) & 255);
+			const int db = (int)(palette[p] & 255) - (int)(texels[i] & 255);
+			const int error = dr * dr + dg * dg + db * db;
+			if (error < bestError) best = p, bestError = error;
+		}
+		block |= (uint64_t)best << (32 + 2 * i);
+	}
+	return block;
+}
+
+// The channel's range as endpoints, eight values between them, and every texel's nearest one
+static uint64_t EncodeBC4(const uint texels[16], const int shift)
+{
+	uint lowest = 255, highest = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		const uint value = (texels[i] >> shift) & 255;
+		lowest = min(lowest, value), highest = max(highest, value);
+	}
+	uint64_t block = (uint64_t)highest | (uint64_t)lowest << 8;
+	if (highest == lowest) return block;
+
+	uint palette[8];
+	PaletteBC4(highest, lowest, palette);
+	for (int i = 0; i < 16; i++)
+	{
+		const int value = (int)((texels[i] >> shift) & 255);
+		int best = 0, bestError = INT_MAX;
+		for (int p = 0; p < 8; p++)
+		{
+			const int error = abs((int)palette[p] - value);
+			if (error < bestError) best = p, bestError = error;
+		}
+		block |= (uint64_t)best << (16 + 3 * i);
+	}
+	return block;
+}
+
+static uint DecodeBC4(const uint64_t block, const int texel)
+{
+	uint palette[8];
+	PaletteBC4((uint)(block & 255), (uint)((block >> 8) & 255), palette);
+	return palette[(block >> (16 + 3 * texel)) & 7];
+}
+
+void BlockTexture::Encode(const uint* pixels, const int width, const int height, const TextureFormat textureFormat, const BlockChannels& textureChannels)
+{
+	format = textureFormat, channels = textureChannels;
+	blocks.clear();
+	if (format == TextureFormat::RGBA8) return;
+
+	blocksX = (width + 3) / 4;
+	const int blocksY = (height + 3) / 4;
+	blocks.reserve((size_t)blocksX * blocksY * (format == TextureFormat::BC5 ? 2 : 1));
+	for (int by = 0; by < blocksY; by++)
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			uint texels[16];
+			for (int i = 0; i < 16; i++)
+			{
+				const int x = min(bx * 4 + (i & 3), width - 1), y = min(by * 4 + (i >> 2), height - 1);
+				texels[i] = pixels[x + y * width];
+			}
+			switch (format)
+			{
+			case TextureFormat::BC1: blocks.push_back(EncodeBC1(texels)); break;
+			case TextureFormat::BC4: blocks.push_back(EncodeBC4(texels, channels.first)); break;
+			default: blocks.push_back(EncodeBC4(texels, channels.first)), blocks.push_back(EncodeBC4(texels, channels.second)); break;
+			}
+		}
+}
+
+uint BlockTexture::Texel(const int x, const int y) const
+{
+	const int texel = (x & 3) + (y & 3) * 4;
+	const size_t index = (size_t)(y >> 2) * blocksX + (x >> 2);
+	if (format == TextureFormat::BC1)
+	{
+		const uint64_t block = blocks[index];
+		uint palette[4] = {};
+		PaletteBC1((uint)(block & 0xffff), (uint)((block >> 16) & 0xffff), palette);
+		return 0xff000000 | palette[(block >> (32 + 2 * texel)) & 3];
+	}
+	if (format == TextureFormat::BC4) return 0xff000000 | DecodeBC4(blocks[index], texel) << channels.first;
+
+	const uint first = DecodeBC4(blocks[index * 2], texel), second = DecodeBC4(blocks[index * 2 + 1], texel);
+	uint result = 0xff000000 | first << channels.first | second << channels.second;
+	if (channels.unitNormal)
+	{
+		const float nx = first * (2.f / 255.f) - 1.f, ny = second * (2.f / 255.f) - 1.f;
+		const float nz = sqrtf(max(0.f, 1.f - nx * nx - ny * ny));
+		result |= (uint)((nz + 1.f) * 127.5f + 0.5f);
+	}
+	return result;
+}
+
+const char* BlockTexture::FormatName(const TextureFormat format)
+{
+	switch (format)
+	{
+	case TextureFormat::BC1: return "bc1";
+	case TextureFormat::BC4: return "bc4";
+	case TextureFormat::BC5: return "bc5";
+	default: return "rgba8";
+	}
+}
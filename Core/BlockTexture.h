@@ -0,0 +1,40 @@
+#pragma once
+
+// Storage formats of a mip level. RGBA8 keeps every texel as a uint; the others compress 4x4 blocks
+// after the GPU formats of the same name, decoded one texel at a time on the CPU:
+enum class TextureFormat
+{
+	RGBA8, // 4 B per texel
+	BC1, // rgb, two 565 endpoints and 2-bit indices, 0.5 B per texel
+	BC4, // one channel, two 8-bit endpoints and 3-bit indices, 0.5 B per texel
+	BC5, // two channels, a BC4 block each, 1 B per texel
+};
+
+// The bytes of a texel BC4 and BC5 keep, as shifts: 16 red, 8 green, 0 blue. The others decode to 0,
+// except blue with unitNormal, which becomes the z that makes the kept x and y a unit tangent space normal.
+struct BlockChannels
+{
+	int first = 16, second = 8;
+	bool unitNormal = false;
+};
+
+// A mip level compressed to 4x4 blocks, row by row. Edges of levels that are not a multiple of 4 repeat their
+// last texel into the padding, lookups never reach it.
+class BlockTexture
+{
+public:
+	void Encode(const uint* pixels, const int width, const int height, const TextureFormat format, const BlockChannels& channels = BlockChannels());
+	bool Empty() const { return blocks.empty(); }
+	size_t Bytes() const { return blocks.size() * sizeof(uint64_t); }
+
+	// Decoded texel at x, y, packed as the RGBA8 texel it was encoded from
+	uint Texel(const int x, const int y) const;
+
+	static const char* FormatName(const TextureFormat format);
+
+private:
+	std::vector<uint64_t> blocks; // 8 bytes per block, two per block in BC5
+	int blocksX = 0;
+	TextureFormat format = TextureFormat::RGBA8;
+	BlockChannels channels;
+};
@@ -7,6 +7,7 @@ Camera::Camera()
 {
 	// Load HDR skydome
 	skyPixels = stbi_loadf("../assets/skydomes/workshop3.hdr", &skyWidth, &skyHeight, &skyBpp, 0);
+	skyCube.Build(skyPixels, skyWidth, skyHeight, skyBpp);
 
 #if  GAMETYPE == DEBUGMODE
 	// Load position and target view from JSON
@@ -40,37 +41,43 @@ Camera::~Camera()
 {
 }
 
-float3 Camera::SampleSkybox(tinybvh::Ray ray)
+void Camera::SetResolution(const int w, const int h)
 {
-	float u = 0.5f + (atan2f(ray.D.z, ray.D.x) / (2.0f * PI));
-	float v = acosf(ray.D.y) / PI;
-
-	float uTex = u * skyWidth;
-	float vTex = v * skyHeight;
-
-	uint u0 = static_cast<uint>(floor(uTex)) % skyWidth;
-	uint v0 = static_cast<uint>(floor(vTex)) % skyHeight;
-	uint u1 = (u0 + 1) % skyWidth;
-	uint v1 = (v0 + 1) % skyHeight;
-
-	float du = uTex - u0;
-	float dv = vTex - v0;
-
-	uint idx00 = (u0 + v0 * skyWidth) * 3;
-	uint idx01 = (u1 + v0 * skyWidth) * 3;
-	uint idx10 = (u0 + v1 * skyWidth) * 3;
-	uint idx11 = (u1 + v1 * skyWidth) * 3;
+	width = w, height = h;
+	aspect = (float)w / (float)h;
+	topLeft = camPos + ahead * 2.0f - aspect * right + up;
+	topRight = camPos + ahead * 2.0f + aspect * right + up;
+	bottomLeft = camPos + ahead * 2.0f - aspect * right - up;
+}
 
-	float3 color00 = float3(skyPixels[idx00], skyPixels[idx00 + 1], skyPixels[idx00 + 2]);
-	float3 color01 = float3(skyPixels[idx01], skyPixels[idx01 + 1], skyPixels[idx01 + 2]);
-	float3 color10 = float3(skyPixels[idx10], skyPixels[idx10 + 1], skyPixels[idx10 + 2]);
-	float3 color11 = float3(skyPixels[idx11], skyPixels[idx11 + 1], skyPixels[idx11 + 2]);
+float Camera::PixelSpread() const
+{
+	const float distance = length((topRight + bottomLeft) * 0.5f - camPos);
+	return atanf(length(bottomLeft - topLeft) / (height * distance));
+}
 
-	float3 interpU0 = color00 + du * (color01 - color00);
-	float3 interpU1 = color10 + du * (color11 - color10);
-	float3 finalColor = interpU0 + dv * (interpU1 - interpU0);
+float3 Camera::SampleSkybox(tinybvh::Ray ray)
+{
+	return skyCube.Lookup(ray.D);
+}
 
-	return finalColor;
+bool Camera::ProjectToView(const View& view, const float3& P, float2& pixel)
+{
+	// Intersect the line from the view's camera to P with its virtual screen plane
+	const float3 E1 = view.topRight - view.topLeft, E2 = view.bottomLeft - view.topLeft;
+	const float3 N = cross(E1, E2);
+	const float3 D = P - view.camPos;
+	const float denom = dot(D, N);
+	if (fabsf(denom) < 1e-8f) return false;
+	const float t = dot(view.topLeft - view.camPos, N) / denom;
+	if (t <= 0) return false; // behind the camera
+
+	const float3 H = view.camPos + D * t - view.topLeft;
+	const float u = dot(H, E1) / dot(E1, E1), v = dot(H, E2) / dot(E2, E2);
+	if (u < 0 || u >= 1 || v < 0 || v >= 1) return false;
+
+	pixel = float2(u * view.width, v * view.height);
+	return true;
 }
 
 // perspective/rectilinear (0 distortion) vs panini
@@ -113,8 +120,8 @@ float3 Camera::Panini(float2 ndc)
 tinybvh::Ray Camera::GetPrimaryRay(const float x, const float y)
 {
 	// calculate pixel position on virtual screen plane
-	const float u = (float)x * (1.0f / SCRWIDTH); // [0,1]
-	const float v = (float)y * (1.0f / SCRHEIGHT);
+	const float u = (float)x * (1.0f / width); // [0,1]
+	const float v = (float)y * (1.0f / height);
 
 	const float2 ndc{ (2.0f * u) - 1.0f, 1.0f - (2.0f * v) }; // [-1,1]
 	const float3 P = topLeft + u * (topRight - topLeft) + v * (bottomLeft - topLeft);
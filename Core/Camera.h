@@ -1,6 +1,7 @@
 #pragma once
 #include "Transform.h"
 #include "tinyBVH.h"
+#include "SkyCube.h"
 
 class Camera
 {
@@ -18,10 +19,12 @@ public:
 	float3 tmpUp{ 0, 1, 0 };
 
 	const float P1_fov = 90.f, P1_distortion = 2.f, P1_vignetteIntensity = 5.5f, P1_vignetteRadius = 0.8f;
-	const float aspect = (float)SCRWIDTH / (float)SCRHEIGHT;
+	int width = SCRWIDTH, height = SCRHEIGHT; // resolution the primary rays are generated for
+	float aspect = (float)SCRWIDTH / (float)SCRHEIGHT;
 	const float P2_fov = fov, P2_distortion = distortion, P2_vignetteIntensity = vignetteIntensity, P2_vignetteRadius = vignetteRadius;
 	float fov = 40.f, distortion = 40.f, vignetteIntensity = 20.f, vignetteRadius = 0.3f;
-	float* skyPixels;
+	float* skyPixels; // The skydome as loaded, SkyLight builds its distribution from it
+	SkyCube skyCube; // What misses look up
 
 	int skyWidth, skyHeight, skyBpp;
 	int abberationIntensity = 0;
@@ -29,10 +32,21 @@ public:
 	const int P2_abberationIntensity = abberationIntensity;
 
 	bool isMovable = true;
+
+	// Pinhole view of a frame, kept to reproject the next frame's hits into it
+	struct View
+	{
+		float3 camPos, topLeft, topRight, bottomLeft;
+		int width, height;
+	};
+	View GetView() const { return View{ camPos, topLeft, topRight, bottomLeft, width, height }; }
+	static bool ProjectToView(const View& view, const float3& P, float2& pixel);
 	
 	float3 SampleSkybox(tinybvh::Ray ray);
+	float PixelSpread() const; // Angle one pixel spans at the center of the view
 	float3 Panini(float2 ndc);
 	tinybvh::Ray GetPrimaryRay(const float x, const float y);
+	void SetResolution(const int w, const int h);
 	bool HandleInput(const float t);
 
 };
\ No newline at end of file
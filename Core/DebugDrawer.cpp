@@ -1,2 +1,5 @@
 #include "precomp.h"
+
+#ifndef HEADLESS
 #include "DebugDrawer.h"
+#endif // HEADLESS
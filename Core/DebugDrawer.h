@@ -37,7 +37,7 @@ struct DebugDrawer : public btIDebugDraw
 
         // VP
         //Perspective
-        glm::mat4 projection = glm::perspective(glm::radians(camera->fov), (float)SCRWIDTH / (float)SCRHEIGHT, 0.1f, 3000000.0f);
+        glm::mat4 projection = glm::perspective(glm::radians(camera->fov), camera->aspect, 0.1f, 3000000.0f);
 
         // View
         glm::mat4 view = glm::lookAtRH(glm::vec3(camera->camPos.x, camera->camPos.y, camera->camPos.z),
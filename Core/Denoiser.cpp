@@ -0,0 +1,184 @@
+#include "precomp.h"
+#include "Denoiser.h"
+
+// B3 spline, the 5x5 kernel is its outer product
+static const float kernel[5] = { 1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16 };
+
+// Albedo below this would blow the demodulated lighting up
+static const float minAlbedo = 0.01f;
+
+// Rows handed to a worker at a time
+static const int rowBatch = 4;
+
+void Denoiser::Planes::Resize(const int size, const float value)
+{
+	x.assign(size, value), y.assign(size, value), z.assign(size, value);
+}
+
+void Denoiser::Resize(const int w, const int h)
+{
+	if (w == width && h == height) return;
+	width = w, height = h;
+
+	const DenoiseFeatures sky;
+	normal.Resize(w * h, 0.f);
+	albedo.Resize(w * h, 1.f);
+	depth.assign(w * h, sky.depth);
+	color[0].Resize(w * h, 0.f), color[1].Resize(w * h, 0.f);
+	result = 0;
+}
+
+void Denoiser::SetFeatures(const int pixel, const DenoiseFeatures& features)
+{
+	normal.x[pixel] = features.normal.x, normal.y[pixel] = features.normal.y, normal.z[pixel] = features.normal.z;
+	albedo.x[pixel] = max(features.albedo.x, minAlbedo);
+	albedo.y[pixel] = max(features.albedo.y, minAlbedo);
+	albedo.z[pixel] = max(features.albedo.z, minAlbedo);
+	depth[pixel] = features.depth;
+}
+
+void Denoiser::SetInput(const int pixel, const float4& input)
+{
+	color[0].x[pixel] = input.x / albedo.x[pixel];
+	color[0].y[pixel] = input.y / albedo.y[pixel];
+	color[0].z[pixel] = input.z / albedo.z[pixel];
+}
+
+void Denoiser::Filter(TileScheduler& scheduler)
+{
+	Timer timer;
+	result = 0;
+	for (int i = 0; i < iterations; i++)
+	{
+		// Wider taps compare pixels further apart, so the color falloff tightens as the kernel grows
+		const int step = 1 << i;
+		const float sigma = colorSigma / step;
+		const Falloff falloff{ 1.f / (sigma * sigma), 1.f / (normalSigma * normalSigma), 1.f / (albedoSigma * albedoSigma), 1.f / depthSigma };
+
+		const Planes& src = color[result];
+		Planes& dst = color[result ^ 1];
+		scheduler.ForEach(height, rowBatch, [&](int first, int last)
+			{
+				for (int y = first; y < last; y++) FilterRow(y, step, falloff, src, dst);
+			});
+		result ^= 1;
+	}
+	filterTime = timer.elapsed() * 1000.f;
+}
+
+float4 Denoiser::Output(const int pixel) const
+{
+	const Planes& lighting = color[result];
+	return float4(lighting.x[pixel] * albedo.x[pixel], lighting.y[pixel] * albedo.y[pixel], lighting.z[pixel] * albedo.z[pixel], 0.f);
+}
+
+void Denoiser::FilterRow(const int y, const int step, const Falloff& falloff, const Planes& src, Planes& dst) const
+{
+	int x = 0;
+#ifdef BVH_USEAVX2
+	// Eight pixels at a time wherever all horizontal taps stay inside the row
+	const int reach = 2 * step;
+	for (; x < min(reach, width); x++) FilterPixel(x, y, step, falloff, src, dst);
+	for (; x + 8 <= width - reach; x += 8) FilterSpan(x, y, step, falloff, src, dst);
+#endif
+	for (; x < width; x++) FilterPixel(x, y, step, falloff, src, dst);
+}
+
+void Denoiser::FilterPixel(const int x, const int y, const int step, const Falloff& falloff, const Planes& src, Planes& dst) const
+{
+	const int p = x + y * width;
+	const float depthScale = falloff.depth / depth[p];
+	auto distance = [p](const Planes& planes, const int q)
+		{
+			const float dx = planes.x[q] - planes.x[p], dy = planes.y[q] - planes.y[p], dz = planes.z[q] - planes.z[p];
+			return dx * dx + dy * dy + dz * dz;
+		};
+
+	float r = 0.f, g = 0.f, b = 0.f, weights = 0.f;
+	for (int ky = 0; ky < 5; ky++)
+	{
+		const int qy = y + (ky - 2) * step;
+		if (qy < 0 || qy >= height) continue;
+		for (int kx = 0; kx < 5; kx++)
+		{
+			const int qx = x + (kx - 2) * step;
+			if (qx < 0 || qx >= width) continue;
+			const int q = qx + qy * width;
+			const float exponent = distance(src, q) * falloff.color + distance(normal, q) * falloff.normal + distance(albedo, q) * falloff.albedo + fabsf(depth[q] - depth[p]) * depthScale;
+			const float weight = kernel[kx] * kernel[ky] * expf(-exponent);
+			r += weight * src.x[q], g += weight * src.y[q], b += weight * src.z[q];
+			weights += weight;
+		}
+	}
+
+	// The center tap always has full weight, so weights > 0
+	const float scale = 1.f / weights;
+	dst.x[p] = r * scale, dst.y[p] = g * scale, dst.z[p] = b * scale;
+}
+
+#ifdef BVH_USEAVX2
+// exp(x) for x <= 0: 2^(x log2 e) as an exponent shift times a polynomial for the fraction
+static inline __m256 Exp8(__m256 x)
+{
+	const __m256 t = _mm256_mul_ps(_mm256_max_ps(x, _mm256_set1_ps(-80.f)), _mm256_set1_ps(1.44269504f));
+	const __m256 whole = _mm256_floor_ps(t);
+	const __m256 f = _mm256_sub_ps(t, whole);
+	__m256 p = _mm256_set1_ps(1.333355815e-3f);
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.618129108e-3f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.550410866e-2f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.402265070e-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.931471806e-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.f));
+	const __m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(whole), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+// Squared distance between the planes at q and the center values c
+static inline __m256 Distance8(const float* x, const float* y, const float* z, const int q, const __m256 cx, const __m256 cy, const __m256 cz)
+{
+	const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + q), cx);
+	const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + q), cy);
+	const __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(z + q), cz);
+	return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+}
+
+void Denoiser::FilterSpan(const int x, const int y, const int step, const Falloff& falloff, const Planes& src, Planes& dst) const
+{
+	// FilterPixel for pixels x..x+7 of a row; the caller guarantees every horizontal tap is inside it
+	const int p = x + y * width;
+	const __m256 cr = _mm256_loadu_ps(&src.x[p]), cg = _mm256_loadu_ps(&src.y[p]), cb = _mm256_loadu_ps(&src.z[p]);
+	const __m256 nx = _mm256_loadu_ps(&normal.x[p]), ny = _mm256_loadu_ps(&normal.y[p]), nz = _mm256_loadu_ps(&normal.z[p]);
+	const __m256 ar = _mm256_loadu_ps(&albedo.x[p]), ag = _mm256_loadu_ps(&albedo.y[p]), ab = _mm256_loadu_ps(&albedo.z[p]);
+	const __m256 z = _mm256_loadu_ps(&depth[p]);
+	const __m256 depthScale = _mm256_div_ps(_mm256_set1_ps(falloff.depth), z);
+	const __m256 colorFalloff = _mm256_set1_ps(falloff.color), normalFalloff = _mm256_set1_ps(falloff.normal), albedoFalloff = _mm256_set1_ps(falloff.albedo);
+	const __m256 signBit = _mm256_set1_ps(-0.f);
+
+	__m256 r = _mm256_setzero_ps(), g = _mm256_setzero_ps(), b = _mm256_setzero_ps(), weights = _mm256_setzero_ps();
+	for (int ky = 0; ky < 5; ky++)
+	{
+		const int qy = y + (ky - 2) * step;
+		if (qy < 0 || qy >= height) continue;
+		for (int kx = 0; kx < 5; kx++)
+		{
+			const int q = x + (kx - 2) * step + qy * width;
+			__m256 exponent = _mm256_mul_ps(Distance8(src.x.data(), src.y.data(), src.z.data(), q, cr, cg, cb), colorFalloff);
+			exponent = _mm256_add_ps(exponent, _mm256_mul_ps(Distance8(normal.x.data(), normal.y.data(), normal.z.data(), q, nx, ny, nz), normalFalloff));
+			exponent = _mm256_add_ps(exponent, _mm256_mul_ps(Distance8(albedo.x.data(), albedo.y.data(), albedo.z.data(), q, ar, ag, ab), albedoFalloff));
+			const __m256 depthDifference = _mm256_andnot_ps(signBit, _mm256_sub_ps(_mm256_loadu_ps(&depth[q]), z));
+			exponent = _mm256_add_ps(exponent, _mm256_mul_ps(depthDifference, depthScale));
+
+			const __m256 weight = _mm256_mul_ps(_mm256_set1_ps(kernel[kx] * kernel[ky]), Exp8(_mm256_xor_ps(exponent, signBit)));
+			r = _mm256_add_ps(r, _mm256_mul_ps(weight, _mm256_loadu_ps(&src.x[q])));
+			g = _mm256_add_ps(g, _mm256_mul_ps(weight, _mm256_loadu_ps(&src.y[q])));
+			b = _mm256_add_ps(b, _mm256_mul_ps(weight, _mm256_loadu_ps(&src.z[q])));
+			weights = _mm256_add_ps(weights, weight);
+		}
+	}
+
+	const __m256 scale = _mm256_div_ps(_mm256_set1_ps(1.f), weights);
+	_mm256_storeu_ps(&dst.x[p], _mm256_mul_ps(r, scale));
+	_mm256_storeu_ps(&dst.y[p], _mm256_mul_ps(g, scale));
+	_mm256_storeu_ps(&dst.z[p], _mm256_mul_ps(b, scale));
+}
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+class TileScheduler;
+
+// Primary hit attributes that steer the filter, the defaults describe the sky
+struct DenoiseFeatures
+{
+	float3 normal{ 0.f }; // shading normal
+	float3 albedo{ 1.f }; // base color, divided out of the lighting while filtering
+	float depth = BVH_FAR; // hit distance
+};
+
+// Edge-avoiding a-trous wavelet filter. Every iteration blurs with a 5x5 B3 spline kernel whose
+// taps lie 2^iteration pixels apart, and weighs each tap down where its lighting, normal, albedo
+// or depth differ from the center pixel. The lighting is filtered with the albedo divided out,
+// so texture detail stays sharp while the noise between similar surfaces is smoothed away.
+class Denoiser
+{
+public:
+	int iterations = 4; // the kernel covers 4 * 2^iterations - 3 pixels
+	float colorSigma = 0.5f; // halved every iteration
+	float normalSigma = 0.3f, albedoSigma = 0.2f;
+	float depthSigma = 0.05f; // relative to the center pixel's depth
+	float filterTime = 0.f; // ms spent filtering during the last frame
+
+	// Sizes the buffers for a width x height grid of render pixels
+	void Resize(const int width, const int height);
+	void SetFeatures(const int pixel, const DenoiseFeatures& features);
+	// Features of the pixel must be set first, the color is stored with their albedo divided out
+	void SetInput(const int pixel, const float4& color);
+	void Filter(TileScheduler& scheduler);
+	float4 Output(const int pixel) const;
+
+private:
+	// Three float channels as separate arrays, so eight neighbouring pixels load as one vector
+	struct Planes
+	{
+		std::vector<float> x, y, z;
+		void Resize(const int size, const float value);
+	};
+
+	// Reciprocals of the squared sigmas of one iteration (depth is not squared)
+	struct Falloff
+	{
+		float color, normal, albedo, depth;
+	};
+
+	void FilterRow(const int y, const int step, const Falloff& falloff, const Planes& src, Planes& dst) const;
+	void FilterPixel(const int x, const int y, const int step, const Falloff& falloff, const Planes& src, Planes& dst) const;
+#ifdef BVH_USEAVX2
+	void FilterSpan(const int x, const int y, const int step, const Falloff& falloff, const Planes& src, Planes& dst) const;
+#endif
+
+	int width = 0, height = 0;
+	Planes normal, albedo;
+	std::vector<float> depth;
+	Planes color[2]; // demodulated lighting, filtered back and forth between the two
+	int result = 0; // color[] holding the output of the last Filter
+};
@@ -0,0 +1,100 @@
+#include "precomp.h"
+#include "Emitters.h"
+
+// Emission texels averaged per triangle to estimate its power
+static const int estimateGrid = 4;
+
+void Emitters::Build(const Scene& scene)
+{
+	entries.clear(), cdf.clear();
+	total = 0.f;
+	instances = (int)scene.gameobjects.size();
+	modelWeights.assign(scene.models.size(), {});
+
+	for (uint instance = 0; instance < (uint)scene.gameobjects.size(); instance++)
+	{
+		const int modelIndex = scene.gameobjects[instance]->modelIndex;
+		if (modelIndex < 0 || modelIndex >= (int)scene.models.size()) continue;
+		const Model* model = scene.models[modelIndex];
+		if (model->emissionTexture == nullptr) continue;
+
+		std::vector<float>& weights = modelWeights[modelIndex];
+		if (weights.empty())
+		{
+			// Area times the mean emission over a grid of points on the triangle, looked up like a hit would
+			const int triangles = (int)model->triangles.size() / 3;
+			weights.assign(triangles, 0.f);
+			for (int prim = 0; prim < triangles; prim++)
+			{
+				const float3 v0 = model->triangles[prim * 3], v1 = model->triangles[prim * 3 + 1], v2 = model->triangles[prim * 3 + 2];
+				const float area = 0.5f * length(cross(v1 - v0, v2 - v0));
+				if (area <= 0.f) continue;
+
+				tinybvh::Ray ray;
+				ray.hit.inst = instance, ray.hit.prim = prim;
+				float emission = 0.f;
+				for (int i = 0; i < estimateGrid; i++)
+					for (int j = 0; j < estimateGrid - i; j++)
+					{
+						ray.hit.u = (i + 1.f / 3) / estimateGrid, ray.hit.v = (j + 1.f / 3) / estimateGrid;
+						emission += BRDF::getInstance()->luminance(scene.GetMaterialBRDF(ray).emissive);
+					}
+				weights[prim] = area * emission / (estimateGrid * (estimateGrid + 1) / 2);
+			}
+		}
+
+		for (uint prim = 0; prim < (uint)weights.size(); prim++)
+		{
+			if (weights[prim] <= 0.f) continue;
+			total += weights[prim];
+			entries.push_back(Entry{ instance, prim });
+			cdf.push_back(total);
+		}
+	}
+}
+
+float Emitters::WorldTriangle(const Scene& scene, const uint instance, const uint prim, float3& v0, float3& v1, float3& v2)
+{
+	const Model* model = scene.models[scene.gameobjects[instance]->modelIndex];
+	const float* transform = scene.blases[instance].transform;
+	v0 = tinybvh::tinybvh_transform_point(model->triangles[prim * 3], transform);
+	v1 = tinybvh::tinybvh_transform_point(model->triangles[prim * 3 + 1], transform);
+	v2 = tinybvh::tinybvh_transform_point(model->triangles[prim * 3 + 2], transform);
+	return 0.5f * length(cross(v1 - v0, v2 - v0));
+}
+
+bool Emitters::Sample(const Scene& scene, const float pick, const float u, const float v, EmitterSample& sample) const
+{
+	if (Empty()) return false;
+	const int index = min((int)(std::upper_bound(cdf.begin(), cdf.end(), pick * total) - cdf.begin()), (int)entries.size() - 1);
+	const Entry& entry = entries[index];
+
+	float3 v0, v1, v2;
+	const float area = WorldTriangle(scene, entry.instance, entry.prim, v0, v1, v2);
+	if (area <= 0.f) return false;
+
+	// Uniform barycentrics, in the hit record's convention: u weighs the second corner, v the third
+	const float root = sqrtf(u);
+	tinybvh::Ray ray;
+	ray.hit.inst = entry.instance, ray.hit.prim = entry.prim;
+	ray.hit.u = root * (1.f - v), ray.hit.v = root * v;
+
+	sample.position = v0 * (1.f - ray.hit.u - ray.hit.v) + v1 * ray.hit.u + v2 * ray.hit.v;
+	sample.normal = normalize(cross(v1 - v0, v2 - v0));
+	sample.emission = scene.GetMaterialBRDF(ray).emissive;
+	sample.pdf = modelWeights[scene.gameobjects[entry.instance]->modelIndex][entry.prim] / total / area;
+	return true;
+}
+
+float Emitters::Pdf(const Scene& scene, const uint instance, const uint prim) const
+{
+	if (Empty() || (int)instance >= instances) return 0.f;
+	const int modelIndex = scene.gameobjects[instance]->modelIndex;
+	if (modelIndex < 0 || modelIndex >= (int)modelWeights.size() || prim >= (uint)modelWeights[modelIndex].size()) return 0.f;
+	const float weight = modelWeights[modelIndex][prim];
+	if (weight <= 0.f) return 0.f;
+
+	float3 v0, v1, v2;
+	const float area = WorldTriangle(scene, instance, prim, v0, v1, v2);
+	return area > 0.f ? weight / total / area : 0.f;
+}
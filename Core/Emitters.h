@@ -0,0 +1,43 @@
+#pragma once
+
+class Scene;
+
+// Point on an emissive triangle, picked for next event estimation
+struct EmitterSample
+{
+	float3 position;
+	float3 normal; // geometric normal of the triangle
+	float3 emission;
+	float pdf; // per unit area, includes the probability of picking the triangle
+};
+
+// Triangles of the scene whose emission texture is not black, so direct light can be sampled from
+// them instead of only being found when a bounce happens to hit one. A triangle is picked in
+// proportion to its object space area times its average emission, then a point uniformly on it.
+class Emitters
+{
+public:
+	// Gathers the emissive triangles of every game object
+	void Build(const Scene& scene);
+	int Instances() const { return instances; } // game objects seen by the last Build
+	bool Empty() const { return total <= 0.f; }
+
+	bool Sample(const Scene& scene, const float pick, const float u, const float v, EmitterSample& sample) const;
+	// Area pdf with which Sample lands on triangle prim of an instance, 0 for triangles it never picks
+	float Pdf(const Scene& scene, const uint instance, const uint prim) const;
+
+private:
+	struct Entry
+	{
+		uint instance, prim;
+	};
+
+	// World space corners of a triangle, returns its area
+	static float WorldTriangle(const Scene& scene, const uint instance, const uint prim, float3& v0, float3& v1, float3& v2);
+
+	std::vector<Entry> entries;
+	std::vector<float> cdf; // running sum of the entries' weights
+	std::vector<std::vector<float>> modelWeights; // per model and triangle, 0 for triangles that do not emit
+	float total = 0.f;
+	int instances = 0;
+};
@@ -0,0 +1,65 @@
+#include "precomp.h"
+#include "FrameGovernor.h"
+
+void FrameGovernor::Update(Tmpl8::Renderer& renderer, const float frameTraceTime)
+{
+	traceTime = traceTime == 0.f ? frameTraceTime : 0.8f * traceTime + 0.2f * frameTraceTime;
+	if (!enabled) return;
+
+	// Every change restarts accumulation, so only react outside a band around the target
+	const float ratio = targetTime / max(traceTime, 0.01f);
+	if (ratio > 0.9f && ratio < 1.25f) return;
+
+	const float scale = renderer.renderScale;
+	if (ratio < 1.f)
+	{
+		// Over budget: shrink the resolution first, trace cost follows the pixel count
+		if (scale > minScale)
+		{
+			const float newScale = max(minScale, scale * max(0.5f, sqrtf(ratio)));
+			renderer.renderScale = newScale;
+			snprintf(decision, sizeof(decision), "scale %.2f -> %.2f (%.1f ms)", scale, newScale, traceTime);
+		}
+		else if (adjustBounces && renderer.bounces > 1)
+		{
+			if (userBounces < 0) userBounces = renderer.bounces, userAA = renderer.AA;
+			renderer.bounces--;
+			snprintf(decision, sizeof(decision), "bounces -> %i (%.1f ms)", renderer.bounces, traceTime);
+		}
+		else if (adjustAA && renderer.AA)
+		{
+			if (userBounces < 0) userBounces = renderer.bounces, userAA = renderer.AA;
+			renderer.AA = false;
+			snprintf(decision, sizeof(decision), "AA off (%.1f ms)", traceTime);
+		}
+		else return;
+	}
+	else
+	{
+		// Time to spare: give back what was taken last, resolution last
+		if (userBounces >= 0 && userAA && !renderer.AA)
+		{
+			renderer.AA = true;
+			snprintf(decision, sizeof(decision), "AA on (%.1f ms)", traceTime);
+		}
+		else if (userBounces >= 0 && renderer.bounces < userBounces)
+		{
+			renderer.bounces++;
+			snprintf(decision, sizeof(decision), "bounces -> %i (%.1f ms)", renderer.bounces, traceTime);
+		}
+		else if (scale < maxScale)
+		{
+			const float newScale = min(maxScale, scale * min(1.25f, sqrtf(ratio)));
+			renderer.renderScale = newScale;
+			snprintf(decision, sizeof(decision), "scale %.2f -> %.2f (%.1f ms)", scale, newScale, traceTime);
+		}
+		else
+		{
+			userBounces = -1;
+			return;
+		}
+	}
+
+	// Let the smoothed time settle on the new settings before deciding again
+	traceTime = 0.f;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+namespace Tmpl8
+{
+class Renderer;
+}
+
+// Holds the trace time of a frame near a target by adjusting the render resolution scale.
+// Once the scale is at its minimum it can also drop bounces and anti-aliasing, and it gives
+// them back (up to the values it found) when there is time to spare again.
+class FrameGovernor
+{
+public:
+	bool enabled = false;
+	float targetTime = 16.6f; // ms of tracing per frame
+	float minScale = 0.25f, maxScale = 1.f;
+	bool adjustBounces = false, adjustAA = false;
+
+	float traceTime = 0.f; // ms, smoothed
+	char decision[96] = "idle"; // last change, for the performance panel
+
+	void Update(Tmpl8::Renderer& renderer, const float frameTraceTime);
+
+private:
+	int userBounces = -1; // settings before the governor first lowered them
+	bool userAA = true;
+};
@@ -0,0 +1,186 @@
+#include "precomp.h"
+#include "LightTree.h"
+
+// cos(max(0, a - b)) from the sines and cosines of a and b
+static float CosSubClamped(const float sinA, const float cosA, const float sinB, const float cosB)
+{
+	if (cosA > cosB) return 1.f;
+	return cosA * cosB + sinA * sinB;
+}
+
+static float SinFromCos(const float cosine)
+{
+	return sqrtf(max(0.f, 1.f - cosine * cosine));
+}
+
+// Largest float below 1, keeps a rescaled random number in [0, 1)
+static const float oneMinusEpsilon = 0.99999994f;
+
+bool LightTree::Update(const std::vector<TreeLight>& newLights)
+{
+	if (newLights == lights && !nodes.empty()) return false;
+	Build(newLights);
+	return true;
+}
+
+void LightTree::Build(const std::vector<TreeLight>& newLights)
+{
+	lights = newLights;
+	order.resize(lights.size());
+	for (int i = 0; i < (int)lights.size(); i++) order[i] = i;
+	nodes.clear();
+	if (lights.empty()) return;
+
+	// A binary tree over N leaves has 2N - 1 nodes
+	nodes.reserve(lights.size() * 2 - 1);
+	nodes.resize(1);
+	BuildNode(0, 0, (int)lights.size());
+}
+
+void LightTree::BuildNode(const int index, const int first, const int count)
+{
+	if (count == 1)
+	{
+		const TreeLight& light = lights[order[first]];
+		const bool spot = light.cosCutoff > -1.f;
+		const float lightPower = BRDF::getInstance()->luminance(light.color);
+		Node& leaf = nodes[index];
+		leaf.boundsMin = leaf.boundsMax = light.position;
+		leaf.axis = light.direction;
+		leaf.spread = spot ? 0.f : PI;
+		leaf.cutoff = spot ? acosf(clamp(light.cosCutoff, -1.f, 1.f)) : PI * 0.5f;
+		// Power over the solid angle the light covers
+		leaf.power = lightPower * (spot ? 2.f * PI * (1.f - light.cosCutoff) : 4.f * PI);
+		leaf.child = -1, leaf.light = order[first];
+		CacheCones(leaf);
+		return;
+	}
+
+	// Median split along the longest axis of the light positions
+	float3 centerMin = lights[order[first]].position, centerMax = centerMin;
+	for (int i = first + 1; i < first + count; i++) centerMin = fminf(centerMin, lights[order[i]].position), centerMax = fmaxf(centerMax, lights[order[i]].position);
+	const float3 extent = centerMax - centerMin;
+	const int axis = extent.x > extent.y && extent.x > extent.z ? 0 : extent.y > extent.z ? 1 : 2;
+	const int half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+		[&](const int a, const int b) { return lights[a].position[axis] < lights[b].position[axis]; });
+
+	// The children are allocated together, their subtrees follow them
+	const int child = (int)nodes.size();
+	nodes[index].child = child, nodes[index].light = -1;
+	nodes.resize(child + 2);
+	BuildNode(child, first, half);
+	BuildNode(child + 1, first + half, count - half);
+
+	const Node& left = nodes[child];
+	const Node& right = nodes[child + 1];
+	Node& node = nodes[index];
+	node.boundsMin = fminf(left.boundsMin, right.boundsMin), node.boundsMax = fmaxf(left.boundsMax, right.boundsMax);
+	node.axis = left.axis, node.spread = left.spread, node.cutoff = left.cutoff, node.power = left.power;
+	MergeCones(node, right);
+	CacheCones(node);
+}
+
+void LightTree::MergeCones(Node& node, const Node& other)
+{
+	// Lights without power are never picked, they do not widen the cones
+	if (other.power <= 0.f) return;
+	if (node.power <= 0.f)
+	{
+		node.axis = other.axis, node.spread = other.spread, node.cutoff = other.cutoff, node.power = other.power;
+		return;
+	}
+	node.power += other.power;
+	node.cutoff = max(node.cutoff, other.cutoff);
+
+	// Smallest cone of axes around both (the DirectionCone union of pbrt-v4)
+	const float between = acosf(clamp(dot(node.axis, other.axis), -1.f, 1.f));
+	if (min(between + other.spread, PI) <= node.spread) return;
+	if (min(between + node.spread, PI) <= other.spread)
+	{
+		node.axis = other.axis, node.spread = other.spread;
+		return;
+	}
+	const float spread = (node.spread + between + other.spread) * 0.5f;
+	const float3 rotationAxis = cross(node.axis, other.axis);
+	if (spread >= PI || dot(rotationAxis, rotationAxis) < 1e-12f)
+	{
+		node.spread = PI;
+		return;
+	}
+
+	// Turn the axis towards the other one, the rotation axis is perpendicular to it
+	const float angle = spread - node.spread;
+	const float3 k = normalize(rotationAxis);
+	node.axis = normalize(node.axis * cosf(angle) + cross(k, node.axis) * sinf(angle));
+	node.spread = spread;
+}
+
+void LightTree::CacheCones(Node& node)
+{
+	node.cosSpread = cosf(node.spread), node.sinSpread = sinf(node.spread);
+	node.cosCutoff = cosf(node.cutoff);
+}
+
+float LightTree::Importance(const Node& node, const float3& I, const float3& N) const
+{
+	if (node.power <= 0.f) return 0.f;
+	const float3 center = (node.boundsMin + node.boundsMax) * 0.5f, diagonal = node.boundsMax - node.boundsMin;
+	const float3 toPoint = I - center;
+	const float distance2 = dot(toPoint, toPoint), radius2 = dot(diagonal, diagonal) * 0.25f;
+
+	// Half angle the bounds subtend as seen from I, everything when I is inside them
+	if (distance2 <= radius2 || distance2 < 1e-12f) return node.power / max(radius2, 1e-6f);
+	const float sin2Bound = radius2 / distance2, cosBound = sqrtf(1.f - sin2Bound), sinBound = sqrtf(sin2Bound);
+	const float3 direction = toPoint * (1.f / sqrtf(distance2));
+
+	// Smallest angle between an emission direction of the node and the direction to I
+	const float cosAxis = dot(node.axis, direction);
+	const float cosEmission = CosSubClamped(SinFromCos(cosAxis), cosAxis, node.sinSpread, node.cosSpread);
+	const float cosReach = CosSubClamped(SinFromCos(cosEmission), cosEmission, sinBound, cosBound);
+	if (cosReach <= node.cosCutoff) return 0.f;
+
+	// Smallest angle between the normal and a direction towards the bounds
+	const float cosIncident = -dot(N, direction);
+	const float cosSurface = CosSubClamped(SinFromCos(cosIncident), cosIncident, sinBound, cosBound);
+	if (cosSurface <= 0.f) return 0.f;
+
+	return node.power * cosReach * cosSurface / distance2;
+}
+
+int LightTree::Sample(const float3& I, const float3& N, float u, float& pmf) const
+{
+	pmf = 0.f;
+	if (Empty()) return -1;
+
+	int index = 0;
+	float probability = 1.f;
+	while (nodes[index].child >= 0)
+	{
+		const int child = nodes[index].child;
+		const float left = Importance(nodes[child], I, N), right = Importance(nodes[child + 1], I, N);
+		if (left + right <= 0.f) return -1;
+
+		// The part of u that picked the child is stretched back to [0, 1) for the next level
+		const float pickLeft = left / (left + right);
+		if (u < pickLeft) index = child, probability *= pickLeft, u = min(u / pickLeft, oneMinusEpsilon);
+		else index = child + 1, probability *= 1.f - pickLeft, u = min((u - pickLeft) / (1.f - pickLeft), oneMinusEpsilon);
+	}
+	if (index == 0 && Importance(nodes[0], I, N) <= 0.f) return -1;
+
+	pmf = probability;
+	return nodes[index].light;
+}
+
+float3 LightTree::Incident(const TreeLight& light, const float3& I, const float3& N, float3& L, float& distance)
+{
+	L = light.position - I;
+	distance = length(L);
+	if (distance <= 0.f) return float3(0.f);
+	L = L / distance;
+
+	const float cosa = dot(N, L);
+	if (cosa <= 0.f) return float3(0.f);
+	if (light.cosCutoff > -1.f && dot(-L, light.direction) <= light.cosCutoff) return float3(0.f); // outside the spot's cone
+	return light.color * (cosa / (distance * distance));
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+// Point or spot light as the light tree sees it
+struct TreeLight
+{
+	float3 position;
+	float3 color; // intensity, falls off with the squared distance
+	float3 direction = float3(0.f, 0.f, 1.f); // spot lights: axis of the cone
+	float cosCutoff = -1.f; // spot lights: cosine of the cone's half angle, -1 lights every direction
+
+	bool operator==(const TreeLight& other) const
+	{
+		return position.x == other.position.x && position.y == other.position.y && position.z == other.position.z &&
+			color.x == other.color.x && color.y == other.color.y && color.z == other.color.z &&
+			direction.x == other.direction.x && direction.y == other.direction.y && direction.z == other.direction.z && cosCutoff == other.cosCutoff;
+	}
+};
+
+// Bounding volume hierarchy over point and spot lights, so a shading point picks one light out of
+// thousands in O(log N). Following Conty Estevez & Kulla, every node bounds the positions, emission
+// directions and power of its lights; traversal walks down one child at a time, picked in proportion
+// to a conservative estimate of the light the child's lights can send to the shading point.
+class LightTree
+{
+public:
+	// Rebuilds when the lights differ from the ones the tree was built over, returns whether it did
+	bool Update(const std::vector<TreeLight>& newLights);
+	void Build(const std::vector<TreeLight>& newLights);
+	bool Empty() const { return nodes.empty() || nodes[0].power <= 0.f; }
+	int Size() const { return (int)lights.size(); }
+	int Nodes() const { return (int)nodes.size(); }
+	float Power() const { return nodes.empty() ? 0.f : nodes[0].power; } // of all lights, over the solid angles they cover
+	const TreeLight& Light(const int index) const { return lights[index]; }
+
+	// Picks a light for point I with normal N using one random number, -1 when no light can reach it.
+	// pmf receives the probability the light was picked with
+	int Sample(const float3& I, const float3& N, float u, float& pmf) const;
+	// Light arriving at I from one light, not counting occlusion; L and distance receive the shadow ray
+	static float3 Incident(const TreeLight& light, const float3& I, const float3& N, float3& L, float& distance);
+
+private:
+	struct Node
+	{
+		float3 boundsMin, boundsMax;
+		float3 axis; // emission directions lie within spread of it, then within cutoff around those
+		float spread, cutoff; // angles in radians
+		float cosSpread, sinSpread, cosCutoff; // cached for the traversal
+		float power;
+		int child; // first of two consecutive children, -1 for a leaf
+		int light; // leaf: the light it holds
+	};
+
+	float Importance(const Node& node, const float3& I, const float3& N) const;
+	void BuildNode(const int index, const int first, const int count);
+	static void MergeCones(Node& node, const Node& other); // also sums the power
+	static void CacheCones(Node& node);
+
+	std::vector<TreeLight> lights;
+	std::vector<int> order; // lights in tree order
+	std::vector<Node> nodes;
+};
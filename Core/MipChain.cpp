@@ -0,0 +1,104 @@
+#include "precomp.h"
+#include "MipChain.h"
+
+// Bits of a coordinate within a tile spread to every other bit, x | y << 1 is the texel's Morton index
+static const uint mortonSpread[8] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+
+void MipChain::Build(Surface* texture, const TextureMap map)
+{
+	levels.clear(), owned.clear();
+	format = Supports(map, formats[(int)map]) ? formats[(int)map] : TextureFormat::RGBA8;
+	if (texture == nullptr || texture->pixels == nullptr) return;
+
+	std::vector<Surface*> surfaces = { texture };
+	while (surfaces.back()->width > 1 && surfaces.back()->height > 1)
+	{
+		Surface* previous = surfaces.back();
+		owned.push_back(std::make_unique<Surface>(previous->width / 2, previous->height / 2));
+		previous->CopyHalfSize(owned.back().get());
+		surfaces.push_back(owned.back().get());
+	}
+
+	for (const Surface* surface : surfaces)
+	{
+		Level level;
+		level.width = surface->width, level.height = surface->height;
+		if (format != TextureFormat::RGBA8)
+		{
+			BlockChannels channels;
+			if (map == TextureMap::RMA) channels.first = 8, channels.second = 0;
+			channels.unitNormal = map == TextureMap::NORMAL;
+			level.blocks.Encode(surface->pixels, level.width, level.height, format, channels);
+			levels.push_back(std::move(level));
+			continue;
+		}
+		if (layout == TextureLayout::LINEAR)
+		{
+			level.pixels = surface->pixels;
+			levels.push_back(std::move(level));
+			continue;
+		}
+
+		// Partial tiles at the right and bottom edges are padded, lookups never reach the padding
+		const int tileSize = 1 << tileShift;
+		level.tilesX = (level.width + tileSize - 1) >> tileShift;
+		const int tilesY = (level.height + tileSize - 1) >> tileShift;
+		level.tiles.assign((size_t)level.tilesX * tilesY * tileSize * tileSize, 0);
+		for (int y = 0; y < level.height; y++)
+			for (int x = 0; x < level.width; x++)
+			{
+				const size_t tile = (size_t)(y >> tileShift) * level.tilesX + (x >> tileShift);
+				level.tiles[tile * tileSize * tileSize + (mortonSpread[x & (tileSize - 1)] | mortonSpread[y & (tileSize - 1)] << 1)] = surface->pixels[x + y * level.width];
+			}
+		levels.push_back(std::move(level));
+	}
+
+	// The tiles and blocks are copies, the levels CopyHalfSize made are no longer read
+	if (layout == TextureLayout::TILED || format != TextureFormat::RGBA8) owned.clear();
+}
+
+uint MipChain::Texel(const float2& uv, const int index) const
+{
+	const Level& level = levels[clamp(index, 0, Levels() - 1)];
+	const int width = level.width, height = level.height;
+	int iu = (int)(uv.x * width) % width, iv = (int)(uv.y * height) % height;
+	if (iu < 0) iu += width;
+	if (iv < 0) iv += height;
+	if (!level.blocks.Empty()) return level.blocks.Texel(iu, iv);
+	if (level.tiles.empty()) return level.pixels[iu + iv * width];
+
+	const int mask = (1 << tileShift) - 1;
+	const size_t tile = (size_t)(iv >> tileShift) * level.tilesX + (iu >> tileShift);
+	return level.tiles[(tile << (2 * tileShift)) + (mortonSpread[iu & mask] | mortonSpread[iv & mask] << 1)];
+}
+
+const char* MipChain::LayoutName(const TextureLayout layout)
+{
+	return layout == TextureLayout::TILED ? "tiled" : "linear";
+}
+
+bool MipChain::Supports(const TextureMap map, const TextureFormat format)
+{
+	switch (format)
+	{
+	case TextureFormat::BC1: return true; // rgb holds every map
+	case TextureFormat::BC5: return map == TextureMap::NORMAL || map == TextureMap::RMA;
+	case TextureFormat::BC4: return false; // no material map has a single channel
+	default: return true;
+	}
+}
+
+size_t MipChain::Bytes() const
+{
+	size_t bytes = 0;
+	for (const Level& level : levels)
+		bytes += !level.blocks.Empty() ? level.blocks.Bytes() : !level.tiles.empty() ? level.tiles.size() * sizeof(uint) : (size_t)level.width * level.height * sizeof(uint);
+	return bytes;
+}
+
+size_t MipChain::UncompressedBytes() const
+{
+	size_t bytes = 0;
+	for (const Level& level : levels) bytes += (size_t)level.width * level.height * sizeof(uint);
+	return bytes;
+}
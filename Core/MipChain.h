@@ -0,0 +1,60 @@
+#pragma once
+#include <memory>
+#include "BlockTexture.h"
+
+// How a mip chain stores its levels. LINEAR reads them row by row. TILED keeps 8x8 tiles of 256 B, the texels of
+// a tile in Morton order, so hits that are close in u and v alike share cache lines and pages.
+enum class TextureLayout
+{
+	LINEAR,
+	TILED,
+};
+
+// What a material texture holds, which decides the formats that can store it and the channels they keep
+enum class TextureMap
+{
+	ALBEDO, // rgb
+	NORMAL, // tangent space xyz in rgb, BC5 keeps x and y
+	RMA, // roughness in green, metalness in blue
+	EMISSION, // rgb
+	MAPS,
+};
+
+// Box-filtered copies of a texture, each half the size of the one before, generated once at load with
+// Surface::CopyHalfSize. Level 0 is the texture itself; the chain stops when a side reaches one texel.
+class MipChain
+{
+public:
+	static inline TextureLayout layout = TextureLayout::TILED; // of the chains built from now on
+	static inline TextureFormat formats[(int)TextureMap::MAPS] = { TextureFormat::BC1, TextureFormat::BC5, TextureFormat::BC5, TextureFormat::BC1 };
+
+	void Build(Surface* texture, const TextureMap map);
+	bool Empty() const { return levels.empty(); }
+	int Levels() const { return (int)levels.size(); }
+	TextureLayout Layout() const { return !levels.empty() && !levels[0].tiles.empty() ? TextureLayout::TILED : TextureLayout::LINEAR; }
+	TextureFormat Format() const { return !levels.empty() && !levels[0].blocks.Empty() ? format : TextureFormat::RGBA8; }
+	size_t Bytes() const; // of every level as stored
+	size_t UncompressedBytes() const; // of every level as RGBA8
+
+	// Nearest texel of a level, the texture repeats outside [0, 1)
+	uint Texel(const float2& uv, const int level) const;
+
+	static const char* LayoutName(const TextureLayout layout);
+	static bool Supports(const TextureMap map, const TextureFormat format);
+
+private:
+	static constexpr int tileShift = 3; // 8x8 texels per tile
+
+	struct Level
+	{
+		int width = 0, height = 0;
+		const uint* pixels = nullptr; // row by row, LINEAR only
+		std::vector<uint> tiles; // tile by tile, row by row, TILED only
+		int tilesX = 0;
+		BlockTexture blocks; // compressed formats only, in place of either layout
+	};
+
+	std::vector<Level> levels;
+	TextureFormat format = TextureFormat::RGBA8;
+	std::vector<std::unique_ptr<Surface>> owned; // the levels CopyHalfSize made, kept while the layout reads them
+};
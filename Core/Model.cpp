@@ -14,12 +14,16 @@ Model::Model(std::string fullPath, std::string name, const std::string textureEx
 
     modelBVH = new tinybvh::BVH8_CPU();
     modelBVH->BuildHQ(triangles.data(), static_cast<uint32_t>(triangles.size() / 3));
+
+    packetBVH = new tinybvh::BVH();
+    packetBVH->Build(triangles.data(), static_cast<uint32_t>(triangles.size() / 3));
 }
 
 Model::~Model()
 {
     delete convexHullShape;
     delete modelBVH;
+    delete packetBVH;
 }
 
 void Model::ProcessBVHTriangles()
@@ -180,6 +184,7 @@ void Model::Load(std::string filename, const std::string ext, std::string shared
     if (scene->HasMaterials())
         material = scene->mMaterials[scene->mMeshes[0]->mMaterialIndex];
 
+    std::vector<Surface*> loaded; // the textures this model owns, shared ones are read by other models too
     auto LoadTexture = [&](const std::string& type, Surface*& textureVar, const std::string ext)
         {
             std::string filePath = directory + "/" + modelNameLoad + "_" + type + ext;
@@ -188,7 +193,10 @@ void Model::Load(std::string filename, const std::string ext, std::string shared
                 filePath = directory + "/" + modelNameLoad + "_" + type + ext;
 
             if (std::filesystem::exists(filePath))
+            {
                 textureVar = new Surface(filePath.c_str());
+                loaded.push_back(textureVar);
+            }
         };
 
     aiString str;
@@ -213,6 +221,20 @@ void Model::Load(std::string filename, const std::string ext, std::string shared
         //Surface* atlas = new Surface(100, 100)
     }
 
+    albedoMips.Build(albedoTexture, TextureMap::ALBEDO);
+    normalMips.Build(normalTexture, TextureMap::NORMAL);
+    metalnessMips.Build(metalnessTexture, TextureMap::RMA);
+    emissionMips.Build(emissionTexture, TextureMap::EMISSION);
+
+    // A compressed chain holds its own top level, the full size texels are only kept for its width and height
+    const std::pair<Surface*, const MipChain*> sampled[] = { { albedoTexture, &albedoMips }, { normalTexture, &normalMips }, { metalnessTexture, &metalnessMips }, { emissionTexture, &emissionMips } };
+    for (const auto& [texture, chain] : sampled)
+    {
+        if (chain->Format() == TextureFormat::RGBA8 || std::find(loaded.begin(), loaded.end(), texture) == loaded.end() || !texture->ownBuffer) continue;
+        FREE64(texture->pixels);
+        texture->pixels = nullptr, texture->ownBuffer = false;
+    }
+
     if (scene->mNumMeshes > 0) 
         ProcessMesh(scene->mMeshes[0]);
 }
@@ -7,6 +7,7 @@
 
 #include "tinyBVH.h"
 #include "ResourceManager.h"
+#include "MipChain.h"
 
 class Model
 {
@@ -32,6 +33,9 @@ public:
 	Surface* emissionTexture = nullptr;
 	Surface* rmaTexture = nullptr;
 
+	// Mip chains of the textures Scene samples, built at the end of Load
+	MipChain albedoMips, normalMips, metalnessMips, emissionMips;
+
 	std::vector<int>indices;
 	std::vector<float3> vertices;
 	std::vector<float3> verticesTexCoords;
@@ -53,6 +57,7 @@ public:
 
 	// BVH
 	tinybvh::BVH8_CPU* modelBVH;
+	tinybvh::BVH* packetBVH; // Regular layout over the same triangles, BVH8_CPU has no packet traversal
 
 	void ProcessBVHTriangles();
 	void ProcessMesh(const aiMesh* mesh);
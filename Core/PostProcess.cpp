@@ -0,0 +1,123 @@
+#include "precomp.h"
+#include "PostProcess.h"
+
+// Rows handed to a worker at a time
+static const int rowBatch = 8;
+
+void PostProcess::Resize(const int w, const int h)
+{
+	width = w, height = h;
+	r.assign(w * h, 0.f), g.assign(w * h, 0.f), b.assign(w * h, 0.f);
+	columnVignette.resize(w);
+	vignetteIntensity = vignetteRadius = -1.f; // recompute the columns on the next Run
+}
+
+void PostProcess::Run(Tmpl8::Renderer& renderer)
+{
+	Timer timer;
+	const Camera& camera = renderer.camera;
+
+	// The sample heatmap is shown as it is
+	const bool heatmap = renderer.renderingMode == Tmpl8::Renderer::RENDER_STATES::SAMPLEHEATMAP;
+	Settings settings;
+	settings.gamma = renderer.GAMMACORRECTED && !heatmap;
+	settings.effects = renderer.isPostProcessed && !heatmap;
+	settings.shift = settings.effects ? camera.abberationIntensity : 0;
+	settings.grading = camera.colorGrading;
+
+	if (settings.effects && (vignetteIntensity != camera.vignetteIntensity || vignetteRadius != camera.vignetteRadius))
+	{
+		vignetteIntensity = camera.vignetteIntensity, vignetteRadius = camera.vignetteRadius;
+		for (int x = 0; x < width; x++)
+		{
+			const float u = x / (float)width;
+			columnVignette[x] = powf(u * (1.f - u), vignetteRadius);
+		}
+	}
+
+	uint* pixels = renderer.screen->pixels;
+	renderer.scheduler.ForEach(height, rowBatch, [&](int first, int last)
+		{
+			for (int y = first; y < last; y++) ProcessRow(y, settings, pixels);
+		});
+	time = timer.elapsed() * 1000.f;
+}
+
+void PostProcess::ProcessRow(const int y, const Settings& settings, uint* pixels) const
+{
+	const float v = y / (float)height;
+	const float rowVignette = settings.effects ? powf(v * (1.f - v) * vignetteIntensity, vignetteRadius) : 1.f;
+
+	int x = 0;
+#ifdef BVH_USEAVX2
+	// Eight pixels at a time wherever both aberration taps stay inside the row
+	const int reach = abs(settings.shift);
+	for (; x < min(reach, width); x++) ProcessPixel(x, y, settings, rowVignette, pixels);
+	for (; x + 8 <= width - reach; x += 8) ProcessSpan(x, y, settings, rowVignette, pixels);
+#endif
+	for (; x < width; x++) ProcessPixel(x, y, settings, rowVignette, pixels);
+}
+
+void PostProcess::ProcessPixel(const int x, const int y, const Settings& settings, const float rowVignette, uint* pixels) const
+{
+	const int row = y * width, p = x + row;
+	float red = r[p], green = g[p], blue = b[p];
+
+	// Chromatic aberration: blend in red from one side and blue from the other, green stays
+	if (settings.shift != 0)
+	{
+		red = 0.75f * red + 0.25f * r[clamp(x + settings.shift, 0, width - 1) + row];
+		blue = 0.75f * blue + 0.25f * b[clamp(x - settings.shift, 0, width - 1) + row];
+	}
+
+	if (settings.gamma) red = sqrtf(max(0.f, red)), green = sqrtf(max(0.f, green)), blue = sqrtf(max(0.f, blue));
+
+	if (settings.effects)
+	{
+		const float vignette = columnVignette[x] * rowVignette;
+		red *= settings.grading.x * vignette, green *= settings.grading.y * vignette, blue *= settings.grading.z * vignette;
+	}
+
+	const uint r8 = (uint)(255.f * clamp(red, 0.f, 1.f)), g8 = (uint)(255.f * clamp(green, 0.f, 1.f)), b8 = (uint)(255.f * clamp(blue, 0.f, 1.f));
+	pixels[p] = (r8 << 16) + (g8 << 8) + b8;
+}
+
+#ifdef BVH_USEAVX2
+void PostProcess::ProcessSpan(const int x, const int y, const Settings& settings, const float rowVignette, uint* pixels) const
+{
+	// ProcessPixel for pixels x..x+7; the caller guarantees the aberration taps are inside the row
+	const int p = x + y * width;
+	__m256 red = _mm256_loadu_ps(&r[p]), green = _mm256_loadu_ps(&g[p]), blue = _mm256_loadu_ps(&b[p]);
+
+	if (settings.shift != 0)
+	{
+		const __m256 keep = _mm256_set1_ps(0.75f), blend = _mm256_set1_ps(0.25f);
+		red = _mm256_add_ps(_mm256_mul_ps(keep, red), _mm256_mul_ps(blend, _mm256_loadu_ps(&r[p + settings.shift])));
+		blue = _mm256_add_ps(_mm256_mul_ps(keep, blue), _mm256_mul_ps(blend, _mm256_loadu_ps(&b[p - settings.shift])));
+	}
+
+	const __m256 zero = _mm256_setzero_ps();
+	if (settings.gamma)
+	{
+		red = _mm256_sqrt_ps(_mm256_max_ps(zero, red));
+		green = _mm256_sqrt_ps(_mm256_max_ps(zero, green));
+		blue = _mm256_sqrt_ps(_mm256_max_ps(zero, blue));
+	}
+
+	if (settings.effects)
+	{
+		const __m256 vignette = _mm256_mul_ps(_mm256_loadu_ps(&columnVignette[x]), _mm256_set1_ps(rowVignette));
+		red = _mm256_mul_ps(red, _mm256_mul_ps(vignette, _mm256_set1_ps(settings.grading.x)));
+		green = _mm256_mul_ps(green, _mm256_mul_ps(vignette, _mm256_set1_ps(settings.grading.y)));
+		blue = _mm256_mul_ps(blue, _mm256_mul_ps(vignette, _mm256_set1_ps(settings.grading.z)));
+	}
+
+	// Clamp, scale and truncate like RGBF32_to_RGB8, then pack as 0x00RRGGBB
+	const __m256 one = _mm256_set1_ps(1.f), scale = _mm256_set1_ps(255.f);
+	const __m256i r8 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(one, _mm256_max_ps(zero, red)), scale));
+	const __m256i g8 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(one, _mm256_max_ps(zero, green)), scale));
+	const __m256i b8 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_min_ps(one, _mm256_max_ps(zero, blue)), scale));
+	const __m256i packed = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r8, 16), _mm256_slli_epi32(g8, 8)), b8);
+	_mm256_storeu_si256((__m256i*)(pixels + p), packed);
+}
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+namespace Tmpl8
+{
+class Renderer;
+}
+
+// Full-frame output pass. Tracing only stores the linear color of every screen pixel; once all
+// tiles are done this pass applies chromatic aberration, gamma, color grading and the vignette
+// and packs the result into the 8-bit screen, eight pixels at a time. Running after tracing
+// means the aberration reads finished neighbours instead of pixels another worker is writing.
+class PostProcess
+{
+public:
+	float time = 0.f; // ms spent in the last Run
+
+	void Store(const int pixel, const float4& color) { r[pixel] = color.x, g[pixel] = color.y, b[pixel] = color.z; }
+	float4 Load(const int pixel) const { return float4(r[pixel], g[pixel], b[pixel], 0.f); }
+	void Resize(const int width, const int height);
+	void Run(Tmpl8::Renderer& renderer);
+
+private:
+	struct Settings
+	{
+		bool gamma, effects; // effects: aberration, grading and vignette
+		int shift; // chromatic aberration in pixels
+		float4 grading;
+	};
+
+	void ProcessRow(const int y, const Settings& settings, uint* pixels) const;
+	void ProcessPixel(const int x, const int y, const Settings& settings, const float rowVignette, uint* pixels) const;
+#ifdef BVH_USEAVX2
+	void ProcessSpan(const int x, const int y, const Settings& settings, const float rowVignette, uint* pixels) const;
+#endif
+
+	int width = 0, height = 0;
+	std::vector<float> r, g, b; // linear frame, one entry per screen pixel
+	// The vignette pow(u(1-u) * v(1-v) * intensity, radius) factors into a column and a row term
+	std::vector<float> columnVignette;
+	float vignetteIntensity = 0.f, vignetteRadius = 0.f;
+};
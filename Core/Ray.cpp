@@ -1,2 +1,6 @@
 #include "precomp.h"
+
+// legacy template ray, superseded by tinybvh::Ray; relies on MSVC anonymous aggregates
+#ifndef HEADLESS
 #include "Ray.h"
+#endif
@@ -1,7 +1,7 @@
 #pragma once
 
 namespace Tmpl8 {
-	__declspec(align(64)) class Ray
+	class ALIGN(64) Ray
 	{
 	public:
 		Ray() = default;
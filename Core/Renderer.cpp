@@ -4,19 +4,59 @@
 
 Renderer* Renderer::renderer_Instance = nullptr;
 
+// Deferred shadow rays of the pixel or packet the current worker is rendering
+static thread_local ShadowBatch shadowBatch;
+
+// Pixel, sample and bounce of the path the current worker is tracing
+static thread_local SampleContext sampleContext;
+
 void Renderer::Init()
 {   
+#ifndef HEADLESS
 	userInterface = new UserInterface();
+#endif
 
-	accumulator = (float4*)MALLOC64(SCRWIDTH * SCRHEIGHT * 16);
-	std::memset(accumulator, 0, SCRWIDTH * SCRHEIGHT * 16);
+	// The entry point picks the resolution through the screen it hands over
+	SetResolution(screen ? screen->width : SCRWIDTH, screen ? screen->height : SCRHEIGHT);
 
+	const float3 sceneMin = scene.tlas.aabbMin, sceneMax = scene.tlas.aabbMax;
+	sceneRadius = max(length(sceneMax - sceneMin) * 0.5f, 1.f);
+	skyLight.Build(camera.skyPixels, camera.skyWidth, camera.skyHeight, camera.skyBpp);
 	InitLights();
 	InitPhysics();
 }
 
 void Tmpl8::Renderer::Shutdown()
 {
+	scheduler.Shutdown();
+}
+
+void Tmpl8::Renderer::SetResolution(const int width, const int height)
+{
+	// Only called between frames, so the resolution may also change while running
+	screenWidth = width, screenHeight = height;
+	if (!screen || screen->width != width || screen->height != height)
+	{
+		delete screen;
+		screen = new Surface(width, height);
+	}
+
+	const int pixels = width * height;
+	accumulator.Resize(pixels, accumulatorFormat), historyAccumulator.Resize(pixels, accumulatorFormat);
+	referenceAccumulator.Resize(VERIFYACCUMULATOR ? pixels : 0, AccumulatorFormat::FLOAT3);
+	samplesTaken.assign(pixels, 0), historySamplesTaken.assign(pixels, 0);
+	distances.assign(pixels, -1.f), historyDistances.assign(pixels, -1.f);
+	luminanceSquares.assign(pixels, 0.f), historyLuminanceSquares.assign(pixels, 0.f);
+
+	postProcess.Resize(width, height);
+	camera.SetResolution(width, height);
+	ResetAccumulation();
+}
+
+void Tmpl8::Renderer::SetAccumulatorFormat(const AccumulatorFormat format)
+{
+	accumulatorFormat = format;
+	SetResolution(screenWidth, screenHeight);
 }
 
 void Renderer::Tick(float deltaTime)
@@ -39,370 +79,956 @@ void Renderer::Tick(float deltaTime)
 
 	// Rebuild TLAS
 	scene.BuildTLAS();
+	if (emitters.Instances() != (int)scene.gameobjects.size()) emitters.Build(scene);
+	GatherLights();
+	if ((LIGHTTREE || RESTIR) && lightTree.Update(treeLights))
+	{
+		// Reservoirs keep lights by their index in the tree
+		std::fill(reservoirs.begin(), reservoirs.end(), Reservoir{});
+		std::fill(previousReservoirs.begin(), previousReservoirs.end(), Reservoir{});
+	}
+	if (!LIGHTTREE) simdPointLights.Assign(treeLights.data(), POINTLIGHTS); // GatherLights puts them first
+	UpdateLightSelection();
+	if (RESTIR)
+	{
+		// Last frame's reservoirs are read by this frame's pixels, which write their own next to them
+		const size_t pixels = (size_t)screenWidth * screenHeight;
+		if (reservoirs.size() != pixels) reservoirs.assign(pixels, Reservoir{}), previousReservoirs.assign(pixels, Reservoir{});
+		else std::swap(reservoirs, previousReservoirs);
+		reservoirFrame++;
+		previousReservoirView = reservoirView;
+		reservoirView = camera.GetView();
+	}
+
+	// Pick up the resolution scale; a different grid invalidates the accumulated pixels
+	const int width = clamp((int)(screenWidth * renderScale), 1, screenWidth), height = clamp((int)(screenHeight * renderScale), 1, screenHeight);
+	if (width != renderWidth || height != renderHeight)
+	{
+		renderWidth = width, renderHeight = height;
+		ResetAccumulation();
+	}
+	pixelSpread = camera.PixelSpread() * screenHeight / renderHeight;
+
+	// Render the frame on the scheduler's worker pool, either tile by tile or in wavefront stages
+	scheduler.ResetStats();
+	if (Denoising()) denoiser.Resize(renderWidth, renderHeight);
+	if (WAVEFRONT && !DEBUG) wavefront.Render(*this);
+	else scheduler.Render(renderWidth, renderHeight, [this](const Tile& tile) { RenderTile(tile); });
+	if (Denoising()) Denoise();
+	postProcess.Run(*this);
+	governor.Update(*this, scheduler.frameTime);
 
-#pragma omp parallel for schedule(dynamic)
-	for (int y = 0; y < SCRHEIGHT; y++)
+	if (CAPTURE) Capture();
+
+	Debug(t);
+
+	adaptiveFrames++;
+	reprojectPending = false;
+	const Camera::View view = camera.GetView();
+	if (camera.HandleInput(deltaTime) || !accumulates)
 	{
-		int pixelHeight = y * SCRWIDTH;
-		for (int x = 0; x < SCRWIDTH; x++)
-		{	
-			if (callDebugBreak)
-				DebugBreak();
+		// Panini rays do not follow the pinhole projection the reprojection relies on
+		if (REPROJECT && accumulates && !isPostProcessed) BeginReprojection(view);
+		else ResetAccumulation();
+	}
+}
 
-			if (DEBUG && !callDebugBreak) screen->pixels[x + pixelHeight] = screen->pixels[x + pixelHeight];
-			else
+void Tmpl8::Renderer::ResetAccumulation()
+{
+	accumulator.Clear();
+	referenceAccumulator.Clear();
+	std::fill(luminanceSquares.begin(), luminanceSquares.end(), 0.f);
+	std::fill(samplesTaken.begin(), samplesTaken.end(), 0);
+	adaptiveFrames = 0;
+	sampleEpoch++;
+	reprojectPending = false;
+}
+
+void Tmpl8::Renderer::BeginReprojection(const Camera::View& view)
+{
+	// Keep this frame's results as history for the next one, which reprojects into it while it accumulates anew
+	std::swap(accumulator, historyAccumulator);
+	historySamplesTaken = samplesTaken;
+	historyDistances = distances;
+	historyLuminanceSquares = luminanceSquares;
+	ResetAccumulation();
+
+	previousView = view;
+	reprojectPending = true;
+}
+
+bool Tmpl8::Renderer::ReprojectHistory(const int x, const int y, const float primaryDistance, float4& history, int& frames, float& luminanceSquare, int& taken)
+{
+	// World position of the primary hit; sky pixels only reproject their direction
+	const tinybvh::Ray primaryRay = camera.GetPrimaryRay((float)x, (float)y);
+	const bool sky = primaryDistance >= BVH_FAR;
+	const float3 P = sky ? previousView.camPos + primaryRay.D : primaryRay.O + primaryRay.D * primaryDistance;
+
+	float2 previousPixel;
+	if (!Camera::ProjectToView(previousView, P, previousPixel)) return false;
+
+	// Snap to the render pixel that held the history
+	const int renderX = min(renderWidth - 1, (int)(previousPixel.x * renderWidth / screenWidth + 0.5f));
+	const int renderY = min(renderHeight - 1, (int)(previousPixel.y * renderHeight / screenHeight + 0.5f));
+	const int pixel = ScreenX(renderX) + ScreenY(renderY) * screenWidth;
+	if (historyAccumulator.Frames(pixel) == 0) return false;
+
+	// Disocclusion: the previous frame must have seen the same surface at that pixel
+	const float previousDistance = historyDistances[pixel];
+	if (sky != (previousDistance >= BVH_FAR)) return false;
+	if (!sky)
+	{
+		const float expected = length(P - previousView.camPos);
+		if (fabsf(previousDistance - expected) > reprojectTolerance * expected) return false;
+	}
+
+	history = historyAccumulator.Average(pixel);
+	frames = historyAccumulator.Frames(pixel);
+	luminanceSquare = historyLuminanceSquares[pixel];
+	taken = historySamplesTaken[pixel];
+	if (frames > reprojectMaxFrames)
+	{
+		const float scale = (float)reprojectMaxFrames / frames;
+		luminanceSquare *= scale;
+		taken = (int)(taken * scale);
+		frames = reprojectMaxFrames;
+	}
+	return true;
+}
+
+void Tmpl8::Renderer::RenderTile(const Tile& tile)
+{
+	// Panini projection bends rays outside the frustum of a packet's corner rays, so it falls back to single rays
+	const bool packets = PACKETS && !DEBUG && !isPostProcessed && bounces > 0;
+	shadowBatch.sorted = SORTSHADOWS;
+	for (int y = tile.y0; y < tile.y1; y += PACKETSIZE)
+		for (int x = tile.x0; x < tile.x1; x += PACKETSIZE)
+		{
+			if (packets && x + PACKETSIZE <= tile.x1 && y + PACKETSIZE <= tile.y1)
 			{
-				float3 traceResult;
+				RenderPacket(x, y);
+				continue;
+			}
+			for (int py = y; py < min(y + PACKETSIZE, tile.y1); py++)
+				for (int px = x; px < min(x + PACKETSIZE, tile.x1); px++)
+					RenderPixel(px, py);
+		}
+}
+
+void Tmpl8::Renderer::RenderPixel(const int renderX, const int renderY)
+{
+	// Screen pixel at the corner of this render pixel's block, and the block size for jittering
+	const int x = ScreenX(renderX), y = ScreenY(renderY);
+	const float footprintX = screenWidth / (float)renderWidth, footprintY = screenHeight / (float)renderHeight;
+	int pixelHeight = y * screenWidth;
+	if (callDebugBreak)
+		DebugBreak();
+
+	if (DEBUG && !callDebugBreak) screen->pixels[x + pixelHeight] = screen->pixels[x + pixelHeight];
+	else
+	{
+		float3 traceResult;
+		DenoiseFeatures features;
+		shadowBatch.target = 0;
 #pragma warning ( push )
 #pragma warning ( disable: 4244 )
-				tinybvh::Ray r1 = camera.GetPrimaryRay(x, y);
-				if (AA)
-				{
-					tinybvh::Ray r2 = camera.GetPrimaryRay(x + RandomFloat(), y + RandomFloat());
+		tinybvh::Ray r1 = camera.GetPrimaryRay(x, y);
+		int samples = AdaptiveSamples(x + pixelHeight);
+		const uint firstSample = SampleIndex(x + pixelHeight, 0);
+		BeginSample(x + pixelHeight, firstSample);
+		if (samples == 0)
+		{
+			// Converged: only make sure the primary hit did not move, then keep the accumulated result
+			scene.tlas.IntersectTLAS(r1);
+			if (abs(distances[x + pixelHeight] - r1.hit.t) < EPSILON)
+			{
+				StorePixel(x, y, float3{ 0.f }, r1.hit.t, 0);
+				return;
+			}
+			samples = AA ? spp : 1;
+			traceResult = Shade(r1, &features);
+		}
+		// First sample through the pixel corner (its hit distance drives accumulation and the denoiser's features), the rest jittered
+		else traceResult = Trace(r1, &features);
+		StoreFeatures(renderX + renderY * renderWidth, features);
+
+		for (int s = 1; s < samples; s++)
+		{
+			BeginSample(x + pixelHeight, firstSample + s);
+			const float2 jitter = Jitter();
+			tinybvh::Ray r2 = camera.GetPrimaryRay(x + jitter.x * footprintX, y + jitter.y * footprintY);
+			traceResult += Trace(r2);
+		}
 #pragma warning ( pop )
-					float3 sample1 = Trace(r1);
-					float3 sample2 = Trace(r2);
-					traceResult = 0.5f * (sample1 + sample2);
-				}
-				else
-				{
-					float3 sample1 = Trace(r1);
-					traceResult = sample1;
-				}
 
-				if (GAMMACORRECTED)
-				{
-					//traceResult = aces(traceResult);
-					traceResult.x = sqrtf(traceResult.x);
-					traceResult.y = sqrtf(traceResult.y);
-					traceResult.z = sqrtf(traceResult.z);
-				}
-				
-				float4 average;
-				if (accumulates)
-				{
-					if (abs(distances[x + pixelHeight] - r1.hit.t) < EPSILON)
-					{
-						samplesPerPixel[x + pixelHeight]++;
-
-						accumulator[x + pixelHeight] += traceResult;
-						average = accumulator[x + pixelHeight] * (1.f / samplesPerPixel[x + pixelHeight]);
-					}
-					else
-					{
-						samplesPerPixel[x + pixelHeight] = 1;
-						accumulator[x + pixelHeight] = traceResult;
-						average = accumulator[x + pixelHeight];
-					}
-
-					distances[x + pixelHeight] = r1.hit.t;
-				}
-				else
-				{
-					accumulator[x + pixelHeight] = traceResult;
-					average = accumulator[x + pixelHeight];
-				}
+		// Direct light of every sample and bounce was deferred, trace it in one batch
+		if (DEFERSHADOWS) shadowBatch.Resolve(scene, &traceResult);
+		traceResult *= 1.f / samples;
+
+		StorePixel(x, y, traceResult, r1.hit.t, samples);
+	}
+}
+
+void Tmpl8::Renderer::RenderPacket(const int x0, const int y0)
+{
+	// Primary visibility for a PACKETSIZE x PACKETSIZE block of render pixels as one coherent packet, shading stays per ray.
+	// Rays are ordered as 4x4 blocks of 4x4 pixels, so rays 0, 51, 204 and 255 are the packet corners.
+	constexpr int count = PACKETSIZE * PACKETSIZE;
+	ALIGN(64) tinybvh::Ray packet[count];
+	float3 traceResult[count];
+	float primaryDistance[count];
+	int pixelX[count], pixelY[count], pixelSamples[count], renderPixel[count];
+	uint firstSample[count];
+	DenoiseFeatures features[count];
+	const float footprintX = screenWidth / (float)renderWidth, footprintY = screenHeight / (float)renderHeight;
+
+	// Samples every pixel of the block needs are traced as packets, adaptive extra samples one by one
+	const int regularSamples = AA ? max(1, spp) : 1;
+	int packetSamples = INT_MAX;
+	for (int i = 0; i < count; i++)
+	{
+		const int block = i >> 4, ray = i & 15;
+		const int renderX = x0 + (block & 3) * 4 + (ray & 3), renderY = y0 + (block >> 2) * 4 + (ray >> 2);
+		pixelX[i] = ScreenX(renderX), pixelY[i] = ScreenY(renderY);
+		renderPixel[i] = renderX + renderY * renderWidth;
+		pixelSamples[i] = AdaptiveSamples(pixelX[i] + pixelY[i] * screenWidth);
+		firstSample[i] = SampleIndex(pixelX[i] + pixelY[i] * screenWidth, 0);
+		packetSamples = min(packetSamples, max(1, pixelSamples[i]));
+		traceResult[i] = float3{ 0.f };
+	}
 
-				
-				if (isPostProcessed)
+	for (int s = 0; s < packetSamples; s++)
+	{
+		// First sample through the pixel corners, the rest jittered; one jitter per packet, drawn by its first pixel, keeps the rays a regular grid
+		BeginSample(pixelX[0] + pixelY[0] * screenWidth, firstSample[0] + s);
+		const float2 jitter = s == 0 ? float2(0.f) : Jitter();
+		for (int i = 0; i < count; i++)
+			packet[i] = camera.GetPrimaryRay(pixelX[i] + jitter.x * footprintX, pixelY[i] + jitter.y * footprintY);
+
+		scene.IntersectPacket(packet);
+
+		for (int i = 0; i < count; i++)
+		{
+			if (s == 0)
+			{
+				primaryDistance[i] = packet[i].hit.t;
+				if (pixelSamples[i] == 0)
 				{
-					// Chromatic Aberration
-					float4 aberratedColor = average;
-					if (camera.abberationIntensity != 0) // Avoid calculations
-					{
-						int shiftedX_R = clamp(x + camera.abberationIntensity, 0, SCRWIDTH - 1);
-						int shiftedX_B = clamp(x - camera.abberationIntensity, 0, SCRWIDTH - 1);
-						float4 color_R = accumulator[shiftedX_R + pixelHeight] * (1.f / samplesPerPixel[x + pixelHeight]);
-						float4 color_B = accumulator[shiftedX_B + pixelHeight] * (1.f / samplesPerPixel[x + pixelHeight]);
-						float red = 0.75f * average.x + 0.25f * color_R.x; // Blend red shift
-						float g = average.y; // Keep green stable
-						float b = 0.75f * average.z + 0.25f * color_B.z; // Blend blue shift
-						aberratedColor = float4(red, g, b, average.w);
-					}
-
-					// Vignette
-					float2 uv = { x / (float)SCRWIDTH, y / (float)SCRHEIGHT };
-					uv *= 1.0f - uv;
-					float vig = uv.x * uv.y * camera.vignetteIntensity;
-					vig = pow(vig, camera.vignetteRadius);
-
-					// Color Grading
-					aberratedColor *= camera.colorGrading;
-#pragma warning ( push )
-#pragma warning ( disable: 4238 )
-					screen->pixels[x + pixelHeight] = RGBF32_to_RGB8(&(aberratedColor * vig));
+					// Converged pixels stay converged unless their primary hit moved
+					if (abs(distances[pixelX[i] + pixelY[i] * screenWidth] - packet[i].hit.t) < EPSILON) continue;
+					pixelSamples[i] = regularSamples;
 				}
-				
-				else
-					screen->pixels[x + pixelHeight] = RGBF32_to_RGB8(&average);
-#pragma warning ( pop )
 			}
+			shadowBatch.target = i;
+			BeginSample(pixelX[i] + pixelY[i] * screenWidth, firstSample[i] + s);
+			traceResult[i] += Shade(packet[i], s == 0 ? &features[i] : nullptr);
 		}
 	}
 
-	if (CAPTURE) Capture();
+	for (int i = 0; i < count; i++)
+	{
+		shadowBatch.target = i;
+		for (int s = packetSamples; s < pixelSamples[i]; s++)
+		{
+			BeginSample(pixelX[i] + pixelY[i] * screenWidth, firstSample[i] + s);
+			const float2 jitter = Jitter();
+			tinybvh::Ray ray = camera.GetPrimaryRay(pixelX[i] + jitter.x * footprintX, pixelY[i] + jitter.y * footprintY);
+			traceResult[i] += Trace(ray);
+		}
+	}
 
-	Debug(t);
+	// One occlusion pass for the direct light of the whole packet
+	if (DEFERSHADOWS) shadowBatch.Resolve(scene, traceResult);
 
-	if (camera.HandleInput(deltaTime) || !accumulates) std::memset(accumulator, 0, SCRWIDTH * SCRHEIGHT * 16);
+	for (int i = 0; i < count; i++)
+	{
+		if (pixelSamples[i] > 0) StoreFeatures(renderPixel[i], features[i]);
+		StorePixel(pixelX[i], pixelY[i], traceResult[i] * (1.f / max(1, pixelSamples[i])), primaryDistance[i], pixelSamples[i]);
+	}
+}
+
+void Tmpl8::Renderer::BeginSample(const int pixel, const uint index, const int depth)
+{
+	// The epoch keys the scramble too, so a restarted accumulation does not repeat the samples it threw away
+	sampleContext.pixel = (uint)pixel + sampleEpoch * (uint)(screenWidth * screenHeight);
+	sampleContext.index = index;
+	sampleContext.depth = depth;
+	sampleContext.screenPixel = pixel;
+}
+
+float Tmpl8::Renderer::Random(const BounceDimension dimension) const
+{
+	return sampler.Get(sampleContext.pixel, sampleContext.index, PIXELDIMENSIONS + sampleContext.depth * BOUNCEDIMENSIONS + dimension);
 }
 
-float3 Tmpl8::Renderer::Trace(tinybvh::Ray& ray, int recursionCap)
+float2 Tmpl8::Renderer::Jitter() const
 {
-	if (recursionCap >= bounces) return float3{ 0.f };
+	return float2(sampler.Get(sampleContext.pixel, sampleContext.index, JITTER_X), sampler.Get(sampleContext.pixel, sampleContext.index, JITTER_Y));
+}
+
+int Tmpl8::Renderer::AdaptiveSamples(const int pixel) const
+{
+	const int regularSamples = AA ? max(1, spp) : 1;
+	const int frames = accumulator.Frames(pixel);
+	if (!ADAPTIVE || !accumulates || frames < adaptiveMinFrames) return regularSamples;
+
+	// Standard error of the mean luminance over the accumulated frames, relative to that mean
+	const float mean = BRDF::getInstance()->luminance(accumulator.Average(pixel));
+	const float variance = max(0.f, luminanceSquares[pixel] / frames - mean * mean);
+	const float error = sqrtf(variance / frames) / max(mean, 0.001f);
+	if (error < adaptiveThreshold) return 0;
+
+	return regularSamples * clamp((int)(error / adaptiveThreshold), 1, adaptiveMaxScale);
+}
+
+void Tmpl8::Renderer::StorePixel(const int x, const int y, float3 traceResult, const float primaryDistance, const int sampleCount)
+{
+	// The accumulator stays linear, gamma is applied by the post-processing pass
+	int pixelHeight = y * screenWidth;
+	float4 average;
+	if (accumulates && sampleCount == 0) average = accumulator.Average(x + pixelHeight);
+	else if (accumulates)
+	{
+		const float luminance = BRDF::getInstance()->luminance(traceResult);
+		float4 history;
+		int historyFrames, historyTaken;
+		float historyLuminanceSquare;
+		if (reprojectPending && ReprojectHistory(x, y, primaryDistance, history, historyFrames, historyLuminanceSquare, historyTaken))
+		{
+			luminanceSquares[x + pixelHeight] = historyLuminanceSquare + luminance * luminance;
+			samplesTaken[x + pixelHeight] = historyTaken + sampleCount;
+
+			// The history average continues with this frame as one more of its frames
+			const float3 historyAverage(history.x, history.y, history.z);
+			const float3 combined = historyAverage + (traceResult - historyAverage) * (1.f / (historyFrames + 1));
+			accumulator.Set(x + pixelHeight, combined, historyFrames + 1);
+			if (VERIFYACCUMULATOR) referenceAccumulator.Set(x + pixelHeight, combined, historyFrames + 1);
+			average = accumulator.Average(x + pixelHeight);
+		}
+		else if (!reprojectPending && abs(distances[x + pixelHeight] - primaryDistance) < EPSILON)
+		{
+			luminanceSquares[x + pixelHeight] += luminance * luminance;
+			samplesTaken[x + pixelHeight] += sampleCount;
 
+			average = accumulator.Add(x + pixelHeight, traceResult);
+			if (VERIFYACCUMULATOR) referenceAccumulator.Add(x + pixelHeight, traceResult);
+		}
+		else
+		{
+			luminanceSquares[x + pixelHeight] = luminance * luminance;
+			samplesTaken[x + pixelHeight] = sampleCount;
+			accumulator.Set(x + pixelHeight, traceResult, 1);
+			if (VERIFYACCUMULATOR) referenceAccumulator.Set(x + pixelHeight, traceResult, 1);
+			average = accumulator.Average(x + pixelHeight);
+		}
+
+		distances[x + pixelHeight] = primaryDistance;
+	}
+	else
+	{
+		accumulator.Set(x + pixelHeight, traceResult, 1);
+		average = accumulator.Average(x + pixelHeight);
+	}
+
+	if (renderingMode == RENDER_STATES::SAMPLEHEATMAP)
+	{
+		// Samples per frame relative to the adaptive maximum: blue is converged, red gets the most samples
+		const float maxSamples = (float)max(1, adaptiveFrames) * (AA ? max(1, spp) : 1) * (ADAPTIVE ? adaptiveMaxScale : 1);
+		const float heat = clamp(samplesTaken[x + pixelHeight] / maxSamples, 0.f, 1.f);
+		OutputPixel(x, y, float4{ heat, 1.f - fabsf(2.f * heat - 1.f), 1.f - heat, 0.f });
+		return;
+	}
+
+	if (Denoising())
+	{
+		// The filter needs the whole frame, Denoise outputs the pixels once every one is in
+		denoiser.SetInput(RenderX(x) + RenderY(y) * renderWidth, average);
+		return;
+	}
+
+	OutputPixel(x, y, average);
+}
+
+void Tmpl8::Renderer::OutputPixel(const int x, const int y, const float4& average)
+{
+	postProcess.Store(x + y * screenWidth, average);
+	FillBlock(x, y);
+}
+
+void Tmpl8::Renderer::StoreFeatures(const int renderPixel, DenoiseFeatures features)
+{
+	if (!Denoising()) return;
+	denoiser.SetFeatures(renderPixel, features);
+}
+
+void Tmpl8::Renderer::Denoise()
+{
+	denoiser.Filter(scheduler);
+
+	// Every render pixel writes its own block of the frame, so rows can be output in parallel
+	scheduler.ForEach(renderHeight, 8, [this](int first, int last)
+		{
+			for (int y = first; y < last; y++)
+				for (int x = 0; x < renderWidth; x++)
+					OutputPixel(ScreenX(x), ScreenY(y), denoiser.Output(x + y * renderWidth));
+		});
+}
+
+void Tmpl8::Renderer::FillBlock(const int x, const int y)
+{
+	if (renderWidth == screenWidth && renderHeight == screenHeight) return;
+
+	// Nearest-neighbour upscale: copy the traced pixel up to the next render pixel's corner
+	const int x1 = ScreenX(RenderX(x) + 1);
+	const int y1 = ScreenY(RenderY(y) + 1);
+	const float4 color = postProcess.Load(x + y * screenWidth);
+	for (int py = y; py < min(y1, screenHeight); py++)
+		for (int px = x; px < min(x1, screenWidth); px++)
+			postProcess.Store(px + py * screenWidth, color);
+}
+
+float3 Tmpl8::Renderer::Trace(tinybvh::Ray& ray, DenoiseFeatures* features)
+{
+	if (bounces <= 0) return float3{ 0.f };
+
+	scene.tlas.IntersectTLAS(ray);
+	return Shade(ray, features);
+}
+
+float3 Tmpl8::Renderer::Shade(tinybvh::Ray& ray, DenoiseFeatures* features)
+{
 	float3 result{ 0.f };
 	float3 throughput{ 1.f };
 
-	scene.tlas.IntersectTLAS(ray);
+	// The primary ray keeps its hit (accumulation reads it), bounces continue in a local ray
+	tinybvh::Ray bounceRay;
+	tinybvh::Ray* path = &ray;
+	float bouncePdf = 0.f; // of the bounce that led to the current hit, 0 for the camera ray
+	float coneWidth = 0.f, coneSpread = pixelSpread; // ray cone for texture LOD, starting from a point at the camera
 
-	if (ray.hit.t >= BVH_FAR) if (SKYBOX) return camera.SampleSkybox(ray); else return float3{ 0.f };
+	for (int depth = 0; depth < bounces; depth++)
+	{
+		sampleContext.depth = depth;
+		if (depth > 0) scene.tlas.IntersectTLAS(*path);
 
-	float3 I = ray.IntersectionPoint();
-	float3 V = -ray.D; // Direction
+		if (path->hit.t >= BVH_FAR)
+		{
+			if (SKYBOX) result += throughput * camera.SampleSkybox(*path) * SkyWeight(path->D, bouncePdf);
+			break;
+		}
+
+		float3 I = path->IntersectionPoint();
+		float3 V = -path->D; // Direction
+
+		float3 geometryNormal = scene.GetGeometryNormal(*path); 
+		// The width the cone reached at the hit picks the textures' mip level
+		coneWidth += coneSpread * path->hit.t;
+		const float lod = TEXTURELOD ? scene.TextureLOD(*path, coneWidth) : 0.f;
+		float3 shadingNormal = scene.GetShadingNormal(*path, lod);
+
+		MaterialProperties hitMaterial = scene.GetMaterialBRDF(*path, lod); 
+		if (depth == 0 && features) *features = DenoiseFeatures{ shadingNormal, hitMaterial.baseColor, path->hit.t };
+
+		// A. Debug Views to see each texture separately
+		float3 debugColor;
+		if (DebugView(hitMaterial, geometryNormal, shadingNormal, debugColor))
+		{
+			result += throughput * debugColor;
+			break;
+		}
 
-	float3 geometryNormal = scene.GetGeometryNormal(ray); 
-	float3 shadingNormal = scene.GetShadingNormal(ray);
+		// A dielectric that continues only carries what it reflects or refracts, so it skips its own lighting
+		const bool lastBounce = depth == bounces - 1;
+		const bool dielectric = hitMaterial.transmissivness == 1;
+		if (!dielectric || lastBounce)
+		{
+			if (hitMaterial.emissive.x > 0.f || hitMaterial.emissive.y > 0.f || hitMaterial.emissive.z > 0.f)
+				result += throughput * hitMaterial.emissive * EmissionWeight(*path, geometryNormal, bouncePdf);
+
+			// B. Direct Illumination
+			ShadowSample shadowSamples[HITSHADOWSAMPLES];
+			int shadowCount = SampleLights(I, shadingNormal, V, hitMaterial, depth, path->hit.t, shadowSamples);
+			if (SampleEmitter(I, shadingNormal, V, hitMaterial, lastBounce, shadowSamples[shadowCount])) shadowCount++;
+			if (SampleSky(I, shadingNormal, V, hitMaterial, lastBounce, shadowSamples[shadowCount])) shadowCount++;
+			for (int i = 0; i < shadowCount; i++)
+			{
+				if (DEFERSHADOWS)
+				{
+					shadowBatch.Push(shadowSamples[i], throughput);
+					continue;
+				}
+				tinybvh::Ray shadowRay(shadowSamples[i].origin, shadowSamples[i].direction, shadowSamples[i].distance);
+				if (!scene.IsOccluded(shadowRay))
+					result += throughput * shadowSamples[i].contribution;
+			}
+		}
+
+		if (lastBounce) break;
 
-	MaterialProperties hitMaterial = scene.GetMaterialBRDF(ray); 
+		// C. Indirect Illumination, a single continuation (dielectrics pick reflection or refraction)
+		tinybvh::Ray nextRay;
+		float3 bounceWeight;
+		if (!SampleBounce(path->D, I, shadingNormal, geometryNormal, hitMaterial, nextRay, bounceWeight, bouncePdf)) break;
+		coneSpread = ConeSpread(coneSpread, bouncePdf);
 
-	// A. Debug Views to see each texture separately
+		throughput *= bounceWeight;
+		if (!RussianRoulette(depth, throughput)) break;
+
+		bounceRay = nextRay;
+		path = &bounceRay;
+	}
+
+	return result;
+}
+
+float Tmpl8::Renderer::ConeSpread(const float spread, const float bouncePdf) const
+{
+	// A lobe sampled with pdf p covers about 1/p steradians, a cone of that solid angle opens 2 / sqrt(pi * p).
+	// Delta bounces keep the spread, a mirror does not blur what it shows
+	if (bouncePdf <= 0.f) return spread;
+	return min(spread + 2.f / sqrtf(PI * bouncePdf), PI);
+}
+
+bool Tmpl8::Renderer::RussianRoulette(const int depth, float3& throughput) const
+{
+	if (!RUSSIANROULETTE || depth + 1 < rouletteDepth) return true;
+
+	// Survive with the path's remaining contribution as probability, survivors are scaled up to stay unbiased
+	const float survival = min(1.f, max(throughput.x, max(throughput.y, throughput.z)));
+	if (survival <= 0.f || Random(ROULETTE) >= survival) return false;
+	throughput *= 1.f / survival;
+	return true;
+}
+
+bool Tmpl8::Renderer::DebugView(const MaterialProperties& material, const float3& geometryNormal, const float3& shadingNormal, float3& color) const
+{
 	switch (renderingMode)
 	{
 		case RENDER_STATES::BASECOLOR:
-			return float3(hitMaterial.baseColor);
-			break;
+			color = float3(material.baseColor);
+			return true;
 		case RENDER_STATES::METAL:
-			return float3(hitMaterial.metalness);
-			break;
+			color = float3(material.metalness);
+			return true;
 		case RENDER_STATES::ROUGHNESS:
-			return float3(hitMaterial.roughness);
-			break;
+			color = float3(material.roughness);
+			return true;
 		case RENDER_STATES::EMMISIVE:
-			return float3(hitMaterial.emissive);
-			break;
+			color = float3(material.emissive);
+			return true;
 		case RENDER_STATES::GEOMETRYNORMAL:
-			return (geometryNormal + 1) * 0.5f;
-			break;
+			color = (geometryNormal + 1) * 0.5f;
+			return true;
 		case RENDER_STATES::SHADINGNORMAL:
-			return (shadingNormal + 1) * 0.5f;
-			break;
+			color = (shadingNormal + 1) * 0.5f;
+			return true;
 		case RENDER_STATES::BRDF:
-			break;
 		default:
-			break;
+			return false;
 	}
+}
+
+int Tmpl8::Renderer::SampleLights(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const int depth, const float distance, ShadowSample samples[HITSHADOWSAMPLES])
+{
+	if (depth > 0 || !Resampling()) return SampleDirectLight(I, shadingNormal, V, material, samples);
+
+	// Reservoirs only hold point-like lights, the area lights' stratified points are traced next to them
+	int count = SampleReservoir(I, shadingNormal, V, material, distance, samples[0]);
+	if (!scene.areaLights.empty() && LIGHTED) count += SampleAreaLight(I, shadingNormal, V, material, Random(LIGHT_PICK), 1.f, samples + count);
+	return count;
+}
 
-	result += throughput * hitMaterial.emissive;
+int Tmpl8::Renderer::SampleDirectLight(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, ShadowSample samples[POINTLIGHTS])
+{
+	if (!LIGHTED) return 0;
 
+	// Without stochastic lighting only the directional light is sampled
+	LIGHT_TYPES type = LIGHT_TYPES::DIRECTIONAL;
+	float probability = 1.f, u = 0.f;
 	if (isStochastic)
 	{
-		float3 illumination{};
-		float3 pointLightContribution{ 0.f, 0.f, 0.f };
-		float3 directionalLightContribution{ 0.f, 0.f, 0.f };
-		float3 spotLightContribution{ 0.f, 0.f, 0.f };
-
-		float pointLightProbability = 0.3f;  // 30%
-		float directionalLightProbability = 0.5f;  // 50%
-		float spotLightProbability = 0.2f;  // 20%
-
-		// Stochasticly Pick Which Light Type Should Be Sampled: Point Lights or Directional
-		float stochasticSeed = RandomFloat();
-		int pick = -1;
-		if (stochasticSeed < pointLightProbability) pick = 0;  // Point light
-		else if (stochasticSeed < pointLightProbability + directionalLightProbability) pick = 1;  // Directional light
-		else pick = 2;  // Spot light
+		// Stochasticly pick which light type is sampled, in proportion to its power (see UpdateLightSelection)
+		const int entry = lightSelection.Sample(Random(LIGHT_PICK), probability, &u);
+		if (entry < 0) return 0;
+		type = lightTypes[entry];
+	}
 
-		if (pick == 0) // A. Point Lights
-		{
-			// 1. Light Calculations
-			// Convert intersection to SIMD intrinsic
-			__m128 Ix = _mm_set1_ps(I.x);
-			__m128 Iy = _mm_set1_ps(I.y);
-			__m128 Iz = _mm_set1_ps(I.z);
-
-			// 1. Lenght Of Vector
-			__m128 Lx = _mm_sub_ps(posX.vec, Ix);
-			__m128 Ly = _mm_sub_ps(posY.vec, Iy);
-			__m128 Lz = _mm_sub_ps(posZ.vec, Iz);
-
-			// 2. Distance
-			__m128 distSq = _mm_add_ps(
-				_mm_add_ps(_mm_mul_ps(Lx, Lx), _mm_mul_ps(Ly, Ly)),
-				_mm_mul_ps(Lz, Lz)
-			);
-			__m128 distanceSIMD = _mm_sqrt_ps(distSq);
-
-			// 3. Normalization. Multiply with reciprocal
-			__m128 invDist = _mm_rcp_ps(distanceSIMD);
-			Lx = _mm_mul_ps(Lx, invDist);
-			Ly = _mm_mul_ps(Ly, invDist);
-			Lz = _mm_mul_ps(Lz, invDist);
-
-			// 4. cosa = dot(N, L)
-			__m128 cosaSIMD = _mm_add_ps(
-				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(shadingNormal.x), Lx),
-					_mm_mul_ps(_mm_set1_ps(shadingNormal.y), Ly)),
-				_mm_mul_ps(_mm_set1_ps(shadingNormal.z), Lz)
-			);
-
-			cosaSIMD = _mm_max_ps(cosaSIMD, _mm_set1_ps(0.0f));
-
-			__m128 finalCalculationX = _mm_mul_ps(colorX.vec, _mm_mul_ps(invDist, cosaSIMD));
-			__m128 finalCalculationY = _mm_mul_ps(colorY.vec, _mm_mul_ps(invDist, cosaSIMD));
-			__m128 finalCalculationZ = _mm_mul_ps(colorZ.vec, _mm_mul_ps(invDist, cosaSIMD));
-
-			for (int i = 0; i < 4; i++)
-			{
-				tinybvh::Ray shadowRay(I + float3{ Lx.m128_f32[i], Ly.m128_f32[i], Lz.m128_f32[i] } *EPSILON, float3{ Lx.m128_f32[i], Ly.m128_f32[i], Lz.m128_f32[i] }, distSq.m128_f32[i] - EPSILON);
+	if (type == LIGHT_TYPES::TREE) return SampleLightTree(I, shadingNormal, V, material, u, probability, samples[0]);
+	if (type == LIGHT_TYPES::AREA) return SampleAreaLight(I, shadingNormal, V, material, u, probability, samples);
 
-				if (!scene.IsOccluded(shadowRay))
-					pointLightContribution += float3{ finalCalculationX.m128_f32[i], finalCalculationY.m128_f32[i], finalCalculationZ.m128_f32[i] };
-			}
+	if (type == LIGHT_TYPES::POINTS) // A. Point Lights
+	{
+		// 1. Light Calculations, every point light at once in the widest SIMD the CPU supports
+		static thread_local LightResults lights;
+		simdPointLights.Evaluate(I, shadingNormal, lights);
 
-			// Proper stochastic: This is to ensure that the final result is unbiased and correctly weighted by the probability.
-			pointLightContribution /= pointLightProbability;
+		// 2. Final Illumination
+		// One BRDF evaluation is shared by all point lights, divided by the pick probability to stay unbiased
+		int whichLight = (int)(Random(LIGHT_SPECULAR) * POINTLIGHTS); // Pick what light source should be evaluated for specular
+		float3 brdf = BRDF::getInstance()->evalCombinedBRDF(shadingNormal, float3{ lights.x[whichLight], lights.y[whichLight], lights.z[whichLight] }, V, material) / probability;
 
-			// 2. Final Illumination 
-			int whichLight = (int)(RandomFloat() * 10) % 4; // Pick what light source should be evaluated for specular
-			result += throughput * (LIGHTED ? (BRDF::getInstance()->evalCombinedBRDF(shadingNormal, float3{ Lx.m128_f32[whichLight], Ly.m128_f32[whichLight], Lz.m128_f32[whichLight] }, V, hitMaterial) * pointLightContribution) : float3{});
-		}
-		else if (pick == 1)// B. Directional Light
+		int count = 0;
+		for (int i = 0; i < POINTLIGHTS; i++)
 		{
-			// 1. Light Calculations
-			float3 L = scene.directionalLights[0]->transform->position - I;
-			float distance = length(L);
-			L = L / distance;
-			float cosa = max(0.0f, dot(shadingNormal, L));
-			tinybvh::Ray shadowRay(I + L * EPSILON, L, distance - EPSILON);
-			if (!scene.IsOccluded(shadowRay))
-				directionalLightContribution = scene.directionalLights[0]->transform->color * cosa;
-
-			// Proper stochastic: This is to ensure that the final result is unbiased and correctly weighted by the probability.
-			directionalLightContribution /= directionalLightProbability;
-
-			// 2. Final Illumination 
-			result += throughput * (LIGHTED ? (BRDF::getInstance()->evalCombinedBRDF(shadingNormal, L, V, hitMaterial) * directionalLightContribution) : float3{});
-		}
-		else if (pick == 2)// B. Spot Light
-		{
-			// 1. Light Calculations
-			float3 L = scene.spotlights[0]->transform->position - I;
-			float distance = length(L);
-			L = L / distance;
-			float cosa = max(0.0f, dot(shadingNormal, L));
-
-			float factor = dot(L, scene.spotlights[0]->transform->rotation);
-
-			tinybvh::Ray shadowRay(I + L * EPSILON, L, distance - EPSILON);
-
-			if (!scene.IsOccluded(shadowRay))
-			{
-				if (factor > 0.9) spotLightContribution = scene.spotlights[0]->transform->color * (1 / (distance * distance)) * cosa;
-				else spotLightContribution = float3(0.f);
-			}
-
-			// Proper stochastic: This is to ensure that the final result is unbiased and correctly weighted by the probability.
-			spotLightContribution /= spotLightProbability;
-
-			// 2. Final Illumination 
-			result += throughput * (LIGHTED ? (BRDF::getInstance()->evalCombinedBRDF(shadingNormal, L, V, hitMaterial) * spotLightContribution) : float3{});
+			if (lights.r[i] <= 0.f && lights.g[i] <= 0.f && lights.b[i] <= 0.f) continue; // No shadow ray for a light that cannot reach the point
+			float3 L{ lights.x[i], lights.y[i], lights.z[i] };
+			samples[count++] = ShadowSample{ I + L * EPSILON, L, lights.distance[i] - EPSILON, brdf * float3{ lights.r[i], lights.g[i], lights.b[i] }, i };
 		}
+		return count;
 	}
-	else
+
+	if (type == LIGHT_TYPES::SPOT) // C. Spot Light
 	{
-		float3 directionalLightContribution;
 		// 1. Light Calculations
-		float3 L = scene.directionalLights[0]->transform->position - I;
+		float3 L = scene.spotlights[0]->transform->position - I;
 		float distance = length(L);
 		L = L / distance;
 		float cosa = max(0.0f, dot(shadingNormal, L));
-		tinybvh::Ray shadowRay(I + L * EPSILON, L, distance - EPSILON);
-		if (!scene.IsOccluded(shadowRay))
-			directionalLightContribution = scene.directionalLights[0]->transform->color * cosa;
 
-		// 2. Final Illumination 
-		result += throughput * (LIGHTED ? (BRDF::getInstance()->evalCombinedBRDF(shadingNormal, L, V, hitMaterial) * directionalLightContribution) : float3{});
+		float factor = dot(L, scene.spotlights[0]->transform->rotation);
+		if (factor <= spotCosCutoff) return 0; // Outside the cone, no need for a shadow ray
+
+		// 2. Final Illumination
+		float3 spotLightContribution = scene.spotlights[0]->transform->color * (1 / (distance * distance)) * cosa / probability;
+		samples[0] = ShadowSample{ I + L * EPSILON, L, distance - EPSILON, BRDF::getInstance()->evalCombinedBRDF(shadingNormal, L, V, material) * spotLightContribution, POINTLIGHTS + 1 };
+		return 1;
 	}
 
-	int brdfType = 1; // Diffuse by default
-	if (recursionCap == bounces - 1) return result;
-	// Fast path for dielectrics
-	if (hitMaterial.transmissivness == 1)
+	// B. Directional Light
+	// 1. Light Calculations
+	float3 L = scene.directionalLights[0]->transform->position - I;
+	float distance = length(L);
+	L = L / distance;
+	float cosa = max(0.0f, dot(shadingNormal, L));
+
+	// 2. Final Illumination
+	float3 directionalLightContribution = scene.directionalLights[0]->transform->color * cosa / probability;
+	samples[0] = ShadowSample{ I + L * EPSILON, L, distance - EPSILON, BRDF::getInstance()->evalCombinedBRDF(shadingNormal, L, V, material) * directionalLightContribution, POINTLIGHTS };
+	return 1;
+}
+
+int Tmpl8::Renderer::SampleLightTree(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const float u, const float probability, ShadowSample& sample) const
+{
+	float pmf;
+	const int index = lightTree.Sample(I, shadingNormal, u, pmf);
+	if (index < 0) return 0;
+
+	const TreeLight& light = lightTree.Light(index);
+	float3 L;
+	float distance;
+	const float3 incident = LightTree::Incident(light, I, shadingNormal, L, distance);
+	if (incident.x <= 0.f && incident.y <= 0.f && incident.z <= 0.f) return 0;
+
+	// Shadow rays are sorted by light: spot lights share the spot light's key, the others spread over the point lights'
+	const int key = light.cosCutoff > -1.f ? POINTLIGHTS + 1 : index % POINTLIGHTS;
+	sample = ShadowSample{ I + L * EPSILON, L, distance - EPSILON, BRDF::getInstance()->evalCombinedBRDF(shadingNormal, L, V, material) * incident / (probability * pmf), key };
+	return 1;
+}
+
+int Tmpl8::Renderer::SampleAreaLight(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const float u, const float probability, ShadowSample samples[POINTLIGHTS]) const
+{
+	// 1. Pick one area light in proportion to its power
+	float total = 0.f;
+	for (const AreaLight* light : scene.areaLights) total += AreaLightPower(*light);
+	if (total <= 0.f) return 0;
+	int index = 0;
+	float remaining = u * total;
+	for (; index < (int)scene.areaLights.size() - 1; index++)
 	{
-		// Albedo for dielectric (we'll assume it is color-neutral here)
-		float3 albedo = float{ 1.f };
+		const float power = AreaLightPower(*scene.areaLights[index]);
+		if (remaining < power) break;
+		remaining -= power;
+	}
+	const AreaLight& light = *scene.areaLights[index];
+	const float pmf = AreaLightPower(light) / total;
+	if (pmf <= 0.f) return 0;
+
+	// 2. Stratified points: even strata along u, golden ratio offsets along v, the whole set shifted by the
+	// sampler's low discrepancy point so every pixel and sample gets its own, well spread, set
+	const int count = clamp(light.samples, 1, AREALIGHTSAMPLES);
+	const float3 normal = light.Normal();
+	const float area = light.Area();
+	const float su = Random(AREA_U), sv = Random(AREA_V);
+	auto wrap = [](const float x) { return x >= 1.f ? x - 1.f : x; };
+	BRDF* brdf = BRDF::getInstance();
+	int traced = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const float3 P = light.PointOnLight(wrap(su + (float)i / count), wrap(sv + fmodf(i * 0.618034f, 1.f)));
+		float3 L = P - I;
+		const float distance = length(L);
+		if (distance <= 0.f) continue;
+		L = L / distance;
+		const float cosa = dot(shadingNormal, L), cosLight = -dot(normal, L);
+		if (cosa <= 0.f || cosLight <= 0.f) continue; // Behind the surface or the light's back, no need for a shadow ray
 
-		// Refractive indices: assuming air (n1 = 1.0) and glass (n2 = 1.46)
-		float n1 = 1.0f;   // Air
-		float n2 = 1.46f;  // Glass
+		// 3. Final Illumination, with the point's solid angle pdf
+		const float pdf = distance * distance / (cosLight * area);
+		const float3 contribution = brdf->evalCombinedBRDF(shadingNormal, L, V, material) * light.transform->color * cosa / (pdf * count * probability * pmf);
+		samples[traced++] = ShadowSample{ I + L * EPSILON, L, distance - EPSILON, contribution, AREALIGHT };
+	}
+	return traced;
+}
 
-		// Calculate cosine of the angle between the ray direction and the normal
-		float cosTheta = clamp(-dot(ray.D, shadingNormal), 0.0f, 1.0f);
+float Tmpl8::Renderer::AreaLightPower(const AreaLight& light) const
+{
+	// Radiance over the hemisphere in front of the light, times its area
+	return BRDF::getInstance()->luminance(light.transform->color) * PI * light.Area();
+}
 
-		// Compute the reflection direction (using the reflection formula)
-		float3 reflectionDir = reflect(ray.D, shadingNormal);
+bool Tmpl8::Renderer::ReprojectReservoir(const float3& I, const int pixel, int& renderX, int& renderY) const
+{
+	if (reservoirFrame < 2) return false; // No view to reproject into yet
 
-		// Trace the reflection ray
-		tinybvh::Ray reflectionRay(I + shadingNormal * EPSILON, reflectionDir);
-		float3 reflected = Trace(reflectionRay, recursionCap + 1);
+	// Panini rays do not follow the pinhole projection, there only a camera that did not move finds the same pixel
+	if (isPostProcessed)
+	{
+		const bool moved = memcmp(&reservoirView, &previousReservoirView, sizeof(Camera::View)) != 0;
+		renderX = RenderX(pixel % screenWidth), renderY = RenderY(pixel / screenWidth);
+		return !moved;
+	}
+
+	float2 previousPixel;
+	if (!Camera::ProjectToView(previousReservoirView, I, previousPixel)) return false;
+	renderX = min(renderWidth - 1, (int)(previousPixel.x * renderWidth / screenWidth + 0.5f));
+	renderY = min(renderHeight - 1, (int)(previousPixel.y * renderHeight / screenHeight + 0.5f));
+	return true;
+}
 
-		// Calculate refraction direction using Snell's Law
-		float eta = n1 / n2; // Ratio of refractive indices
-		float k = 1.0f - eta * eta * (1.0f - cosTheta * cosTheta); // Term to check if total internal reflection occurs
+int Tmpl8::Renderer::SampleReservoir(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const float depth, ShadowSample& sample)
+{
+	if (!LIGHTED) return 0;
+	const int pixel = sampleContext.screenPixel;
+
+	// One sampler dimension seeds the stream of candidates and reuse decisions, whose count varies with the settings
+	uint seed = (uint)(Random(RESERVOIR_SEED) * 4294967040.f) + 1;
+	auto next = [&]() { return min(RandomFloat(seed), 0.99999994f); };
+	float3 L;
+	float distance;
+	auto target = [&](const int light) { return BRDF::getInstance()->luminance(EvaluateLight(light, I, shadingNormal, V, material, L, distance)); };
+
+	// 1. Fresh candidates, weighted by their unshadowed contribution over the probability they were picked with
+	Reservoir reservoir;
+	float keptTarget = 0.f;
+	for (int c = 0; c < restirCandidates; c++)
+	{
+		float pmf;
+		const int light = SampleLightCandidate(I, shadingNormal, next(), pmf);
+		if (light < 0) continue;
+		const float p = target(light);
+		if (reservoir.Update(light, p / pmf, next())) keptTarget = p;
+	}
+	reservoir.M = (float)restirCandidates;
 
-		float3 refracted(0.0f);
-		if (k > 0.0f)
+	// 2. Reuse what this hit's pixel in last frame's view and a few neighbors there kept, weighted by how much their
+	// light gives here. Only reservoirs written last frame count, at the distance last frame's camera saw this hit at
+	const float previousDepth = length(I - previousReservoirView.camPos);
+	auto reuse = [&](const Reservoir& other)
+	{
+		if (other.frame != reservoirFrame - 1 || other.light < 0 || other.W <= 0.f || other.depth <= 0.f) return;
+		if (fabsf(other.depth - previousDepth) > 0.1f * previousDepth || dot(other.normal, shadingNormal) < 0.9f) return;
+		const float M = min(other.M, (float)(restirHistory * restirCandidates));
+		const float p = target(other.light);
+		if (reservoir.Update(other.light, p * other.W * M, next())) keptTarget = p;
+		reservoir.M += M;
+	};
+	int previousX, previousY;
+	if (ReprojectReservoir(I, pixel, previousX, previousY))
+	{
+		reuse(previousReservoirs[ScreenX(previousX) + ScreenY(previousY) * screenWidth]);
+		for (int n = 0; n < restirNeighbors; n++)
 		{
-			// Refract the ray: Snell's law (refracted direction)
-			float3 refractedDir = refract(ray.D, shadingNormal, eta);
-			tinybvh::Ray refractionRay(I - shadingNormal * EPSILON, refractedDir);
-			refracted = Trace(refractionRay, recursionCap + 1);
+			const int x = clamp(previousX + (int)((next() * 2.f - 1.f) * restirRadius), 0, renderWidth - 1);
+			const int y = clamp(previousY + (int)((next() * 2.f - 1.f) * restirRadius), 0, renderHeight - 1);
+			if (x != previousX || y != previousY) reuse(previousReservoirs[ScreenX(x) + ScreenY(y) * screenWidth]);
 		}
+	}
 
-		// Fresnel approximation (Schlick's formula)
-		float R0 = ((n1 - n2) / (n1 + n2)) * ((n1 - n2) / (n1 + n2)); // Fresnel term at normal incidence
-		float fresnel = R0 + (1.0f - R0) * pow(1.0f - cosTheta, 5.0f); // Fresnel term for non-normal incidence
+	reservoir.W = keptTarget > 0.f ? reservoir.weightSum / (reservoir.M * keptTarget) : 0.f;
+	reservoir.normal = shadingNormal, reservoir.depth = depth, reservoir.frame = reservoirFrame;
+	// Only the pixel's first sample of the frame keeps its reservoir, so no two threads ever write the same one
+	if (sampleContext.index == (uint)samplesTaken[pixel]) reservoirs[pixel] = reservoir;
+
+	// 3. A single shadow ray towards the kept light
+	if (reservoir.light < 0 || reservoir.W <= 0.f) return 0;
+	const float3 contribution = EvaluateLight(reservoir.light, I, shadingNormal, V, material, L, distance);
+	const bool directional = reservoir.light == lightTree.Size();
+	const int key = directional ? POINTLIGHTS : lightTree.Light(reservoir.light).cosCutoff > -1.f ? POINTLIGHTS + 1 : reservoir.light % POINTLIGHTS;
+	sample = ShadowSample{ I + L * EPSILON, L, distance - EPSILON, contribution * reservoir.W, key };
+	return 1;
+}
 
-		// Total internal reflection handling (if k < 0, no refraction)
-		if (k <= 0.0f) fresnel = 1.0f;  // Total internal reflection occurs when k <= 0
+int Tmpl8::Renderer::SampleLightCandidate(const float3& I, const float3& shadingNormal, const float u, float& pmf) const
+{
+	float remapped;
+	const int entry = lightSelection.Sample(u, pmf, &remapped);
+	if (entry < 0) return -1;
+	if (lightTypes[entry] == LIGHT_TYPES::DIRECTIONAL) return lightTree.Size();
+	if (lightTypes[entry] != LIGHT_TYPES::TREE) return -1;
+
+	float treePmf;
+	const int light = lightTree.Sample(I, shadingNormal, remapped, treePmf);
+	pmf *= treePmf;
+	return light;
+}
 
-		// Return the final color after blending reflection and refraction
-		return albedo * (fresnel * reflected + (1.0f - fresnel) * refracted);
+float3 Tmpl8::Renderer::EvaluateLight(const int light, const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, float3& L, float& distance) const
+{
+	float3 incident(0.f);
+	if (light >= 0 && light < lightTree.Size()) incident = LightTree::Incident(lightTree.Light(light), I, shadingNormal, L, distance);
+	else if (light == lightTree.Size() && !scene.directionalLights.empty())
+	{
+		L = scene.directionalLights[0]->transform->position - I;
+		distance = length(L);
+		L = L / distance;
+		incident = scene.directionalLights[0]->transform->color * max(0.f, dot(shadingNormal, L));
 	}
-	else
+	if (incident.x <= 0.f && incident.y <= 0.f && incident.z <= 0.f) return float3(0.f);
+	return BRDF::getInstance()->evalCombinedBRDF(shadingNormal, L, V, material) * incident;
+}
+
+bool Tmpl8::Renderer::SampleBounce(const float3& D, const float3& I, const float3& shadingNormal, const float3& geometryNormal, const MaterialProperties& material, tinybvh::Ray& bounceRay, float3& weight, float& pdf)
+{
+	pdf = 0.f;
+
+	// Dielectrics: follow either the reflection or the refraction, picked with the Fresnel term as probability
+	if (material.transmissivness == 1)
 	{
-		// Fast path for perfect mirrors
-		if (hitMaterial.metalness == 1.0f && hitMaterial.roughness == 0.0f)
-			brdfType = SPECULAR_TYPE;
-		else
-		{
-			float brdfProbability = BRDF::getInstance()->getBrdfProbability(hitMaterial, V, shadingNormal);
+		float n1 = 1.0f;   // Air
+		float n2 = 1.46f;  // Glass
 
-			if (RandomFloat() < brdfProbability)
-			{
-				brdfType = SPECULAR_TYPE;
-				throughput /= brdfProbability;
-			}
-			else
-			{
-				brdfType = DIFFUSE_TYPE;
-				throughput /= (1.0f - brdfProbability);
-			}
-		}
+		float cosTheta = clamp(-dot(D, shadingNormal), 0.0f, 1.0f);
+		float eta = n1 / n2;
+		float k = 1.0f - eta * eta * (1.0f - cosTheta * cosTheta);
+
+		float R0 = ((n1 - n2) / (n1 + n2)) * ((n1 - n2) / (n1 + n2));
+		float fresnel = k <= 0.0f ? 1.0f : R0 + (1.0f - R0) * pow(1.0f - cosTheta, 5.0f);
+
+		// Picking with probability fresnel cancels the fresnel weight, so the path keeps its throughput
+		weight = float3{ 1.f };
+		if (Random(BOUNCE_PICK) < fresnel) bounceRay = tinybvh::Ray(I + shadingNormal * EPSILON, reflect(D, shadingNormal));
+		else bounceRay = tinybvh::Ray(I - shadingNormal * EPSILON, refract(D, shadingNormal, eta));
+		return true;
 	}
-	
+
+	int brdfType = DIFFUSE_TYPE;
+	float3 throughput{ 1.f };
+
+	const float brdfProbability = SpecularProbability(material, -D, shadingNormal);
+	if (Random(BOUNCE_PICK) < brdfProbability)
+	{
+		brdfType = SPECULAR_TYPE;
+		throughput /= brdfProbability;
+	}
+	else
+	{
+		brdfType = DIFFUSE_TYPE;
+		throughput /= (1.0f - brdfProbability);
+	}
+
 	float3 brdfWeight{ 1.f }, rayDirection;
-	float2 u = float2(RandomFloat(), RandomFloat());
+	float2 u = float2(Random(BOUNCE_U), Random(BOUNCE_V));
 
-	if (!BRDF::getInstance()->evalIndirectCombinedBRDF(u, shadingNormal, geometryNormal, V, hitMaterial, brdfType, rayDirection, brdfWeight))
-		return result;
+	if (!BRDF::getInstance()->evalIndirectCombinedBRDF(u, shadingNormal, geometryNormal, -D, material, brdfType, rayDirection, brdfWeight))
+		return false;
 
-	throughput *= brdfWeight;
-#pragma warning ( push )
-#pragma warning ( disable: 4239 )
-	return result + Trace(tinybvh::Ray(I + rayDirection * EPSILON, rayDirection), recursionCap + 1) * throughput;
-#pragma warning ( pop )
+	weight = throughput * brdfWeight;
+	bounceRay = tinybvh::Ray(I + rayDirection * EPSILON, rayDirection);
+	const float lobeProbability = brdfType == SPECULAR_TYPE ? brdfProbability : 1.f - brdfProbability;
+	pdf = lobeProbability * BRDF::getInstance()->evalIndirectPdf(shadingNormal, rayDirection, -D, material, brdfType);
+	return true;
+}
+
+float Tmpl8::Renderer::SpecularProbability(const MaterialProperties& material, const float3& V, const float3& shadingNormal) const
+{
+	// Perfect mirrors always reflect
+	if (material.metalness == 1.0f && material.roughness == 0.0f) return 1.f;
+	return BRDF::getInstance()->getBrdfProbability(material, V, shadingNormal);
+}
+
+bool Tmpl8::Renderer::SampleEmitter(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const bool lastBounce, ShadowSample& sample)
+{
+	if (!LIGHTED || misHeuristic == MIS_HEURISTIC::OFF || emitters.Empty()) return false;
+
+	EmitterSample point;
+	if (!emitters.Sample(scene, Random(EMITTER_PICK), Random(EMITTER_U), Random(EMITTER_V), point)) return false;
+	float3 L = point.position - I;
+	const float distanceSquared = dot(L, L);
+	const float distance = sqrtf(distanceSquared);
+	L = L / distance;
+	const float cosLight = fabsf(dot(point.normal, L));
+	if (cosLight <= 0.f || dot(shadingNormal, L) <= 0.f) return false;
+	const float lightPdf = point.pdf * distanceSquared / cosLight; // area to solid angle
+
+	// Each part of the BRDF is weighted against the lobe whose bounce could have hit the emitter as well.
+	// The last bounce and dielectrics, which only ever follow a delta choice, leave light sampling on its own.
+	float3 diffuse, specular;
+	BRDF::getInstance()->evalCombinedBRDFLobes(shadingNormal, L, V, material, diffuse, specular);
+	float diffuseWeight = 1.f, specularWeight = 1.f;
+	if (!lastBounce && material.transmissivness != 1)
+	{
+		const float specularProbability = SpecularProbability(material, V, shadingNormal);
+		const float diffusePdf = (1.f - specularProbability) * BRDF::getInstance()->evalIndirectPdf(shadingNormal, L, V, material, DIFFUSE_TYPE);
+		const float specularPdf = specularProbability * BRDF::getInstance()->evalIndirectPdf(shadingNormal, L, V, material, SPECULAR_TYPE);
+		diffuseWeight = MISWeight(lightPdf, diffusePdf), specularWeight = MISWeight(lightPdf, specularPdf);
+	}
+
+	const float3 contribution = (diffuse * diffuseWeight + specular * specularWeight) * point.emission * (1.f / lightPdf);
+	sample = ShadowSample{ I + L * EPSILON, L, distance - 2 * EPSILON, contribution, EMITTERLIGHT };
+	return true;
+}
+
+bool Tmpl8::Renderer::SampleSky(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const bool lastBounce, ShadowSample& sample)
+{
+	if (!SKYBOX || !LIGHTED || misHeuristic == MIS_HEURISTIC::OFF || skyLight.Empty()) return false;
+
+	SkySample direction;
+	if (!skyLight.Sample(Random(SKY_U), Random(SKY_V), direction)) return false;
+	const float3 L = direction.direction;
+	if (dot(shadingNormal, L) <= 0.f) return false;
+
+	// Weighted per lobe against the bounces, as SampleEmitter does
+	float3 diffuse, specular;
+	BRDF::getInstance()->evalCombinedBRDFLobes(shadingNormal, L, V, material, diffuse, specular);
+	float diffuseWeight = 1.f, specularWeight = 1.f;
+	if (!lastBounce && material.transmissivness != 1)
+	{
+		const float specularProbability = SpecularProbability(material, V, shadingNormal);
+		const float diffusePdf = (1.f - specularProbability) * BRDF::getInstance()->evalIndirectPdf(shadingNormal, L, V, material, DIFFUSE_TYPE);
+		const float specularPdf = specularProbability * BRDF::getInstance()->evalIndirectPdf(shadingNormal, L, V, material, SPECULAR_TYPE);
+		diffuseWeight = MISWeight(direction.pdf, diffusePdf), specularWeight = MISWeight(direction.pdf, specularPdf);
+	}
+
+	const float3 radiance = camera.SampleSkybox(tinybvh::Ray(I, L));
+	const float3 contribution = (diffuse * diffuseWeight + specular * specularWeight) * radiance * (1.f / direction.pdf);
+	sample = ShadowSample{ I + L * EPSILON, L, BVH_FAR, contribution, SKYLIGHT };
+	return true;
+}
+
+float Tmpl8::Renderer::SkyWeight(const float3& D, const float bouncePdf) const
+{
+	// Camera rays, delta bounces and hits that did not sample the sky are the only way to reach it
+	if (!LIGHTED || misHeuristic == MIS_HEURISTIC::OFF || bouncePdf <= 0.f || skyLight.Empty()) return 1.f;
+	return MISWeight(bouncePdf, skyLight.Pdf(D));
+}
+
+float Tmpl8::Renderer::EmissionWeight(const tinybvh::Ray& ray, const float3& geometryNormal, const float bouncePdf) const
+{
+	// Camera rays and delta bounces are the only way to reach what they hit, and so are all bounces when
+	// SampleEmitter is not sampling emitters
+	if (!LIGHTED || misHeuristic == MIS_HEURISTIC::OFF || bouncePdf <= 0.f || emitters.Empty()) return 1.f;
+
+	const float cosLight = fabsf(dot(normalize(geometryNormal), ray.D));
+	if (cosLight <= 0.f) return 1.f;
+	const float lightPdf = emitters.Pdf(scene, ray.hit.inst, ray.hit.prim) * ray.hit.t * ray.hit.t / cosLight;
+	return MISWeight(bouncePdf, lightPdf);
+}
+
+float Tmpl8::Renderer::MISWeight(const float pdf, const float otherPdf) const
+{
+	if (misHeuristic == MIS_HEURISTIC::BALANCE) return pdf / (pdf + otherPdf);
+	if (misHeuristic == MIS_HEURISTIC::POWER) return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+	return 1.f;
 }
 
 void Tmpl8::Renderer::InitLights()
@@ -416,6 +1042,67 @@ void Tmpl8::Renderer::InitLights()
 	colorZ.f[0] = cZLights[0]; colorZ.f[1] = cZLights[1]; colorZ.f[2] = cZLights[2]; colorZ.f[3] = cZLights[3];
 }
 
+void Tmpl8::Renderer::GatherLights()
+{
+	treeLights.clear();
+	for (int i = 0; i < POINTLIGHTS; i++)
+	{
+		TreeLight light;
+		light.position = float3(posX.f[i], posY.f[i], posZ.f[i]);
+		light.color = float3(colorX.f[i], colorY.f[i], colorZ.f[i]);
+		treeLights.push_back(light);
+	}
+	for (const SpotLight* spotlight : scene.spotlights)
+	{
+		// The rotation points from the lit surfaces back to the light, as in SampleDirectLight's cone test
+		const float3 axis = spotlight->transform->rotation;
+		if (dot(axis, axis) <= 0.f) continue; // without a direction the cone lights nothing
+		TreeLight light;
+		light.position = spotlight->transform->position, light.color = spotlight->transform->color;
+		light.direction = -normalize(axis), light.cosCutoff = spotCosCutoff;
+		treeLights.push_back(light);
+	}
+	treeLights.insert(treeLights.end(), bulbs.begin(), bulbs.end());
+}
+
+void Tmpl8::Renderer::UpdateLightSelection()
+{
+	// Power over the solid angle every type covers, like the light tree's nodes
+	BRDF* brdf = BRDF::getInstance();
+	lightTypes.clear(), lightPowers.clear();
+	if (LIGHTTREE || RESTIR)
+	{
+		lightTypes.push_back(LIGHT_TYPES::TREE);
+		lightPowers.push_back(lightTree.Power());
+	}
+	else
+	{
+		float pointPower = 0.f;
+		for (int i = 0; i < POINTLIGHTS; i++) pointPower += brdf->luminance(float3(colorX.f[i], colorY.f[i], colorZ.f[i])) * 4.f * PI;
+		lightTypes.push_back(LIGHT_TYPES::POINTS);
+		lightPowers.push_back(pointPower);
+		if (!scene.spotlights.empty())
+		{
+			const float3 axis = scene.spotlights[0]->transform->rotation;
+			lightTypes.push_back(LIGHT_TYPES::SPOT);
+			lightPowers.push_back(dot(axis, axis) > 0.f ? brdf->luminance(scene.spotlights[0]->transform->color) * 2.f * PI * (1.f - spotCosCutoff) : 0.f);
+		}
+	}
+	if (!scene.directionalLights.empty())
+	{
+		lightTypes.push_back(LIGHT_TYPES::DIRECTIONAL);
+		lightPowers.push_back(brdf->luminance(scene.directionalLights[0]->transform->color) * PI * sceneRadius * sceneRadius);
+	}
+	float areaPower = 0.f;
+	for (const AreaLight* light : scene.areaLights) areaPower += AreaLightPower(*light);
+	if (areaPower > 0.f)
+	{
+		lightTypes.push_back(LIGHT_TYPES::AREA);
+		lightPowers.push_back(areaPower);
+	}
+	lightSelection.Update(lightPowers);
+}
+
 void Tmpl8::Renderer::InitPhysics()
 {
 	// Bullet Physics World Initialization
@@ -430,8 +1117,10 @@ void Tmpl8::Renderer::InitPhysics()
 	dynamicsWorld->addRigidBody(Spaceship->body);
 	scene.physicsobjects.push_back(Spaceship);
 
+#ifndef HEADLESS
 	dynamicsWorld->setDebugDrawer(debugger);
 	debugger->setDebugMode(btIDebugDraw::DBG_DrawWireframe | btIDebugDraw::DBG_DrawAabb | btIDebugDraw::DBG_DrawContactPoints);
+#endif
 }
 
 void Tmpl8::Renderer::Capture()
@@ -442,11 +1131,20 @@ void Tmpl8::Renderer::Capture()
 	std::chrono::duration<double> elapsed_seconds = end - start;
 	std::time_t end_time = std::chrono::system_clock::to_time_t(end);
 
+	std::ostringstream ss;
+	ss << "../assets/captures/capture_" << std::put_time(std::localtime(&end_time), "%Y-%m-%d_%H-%M-%S") << ".png";
+
+	SaveScreen(ss.str().c_str());
+	CAPTURE = false;
+}
+
+void Tmpl8::Renderer::SaveScreen(const char* fileName)
+{
 	// stbi write png takes RGB but screen pixels is uint format (4 byte integers)
 	// the function expects raw 8 bit rgbrgbrgb... not 32 bit integers
 	// convert from 32 bit form (argb) to rgb
-	uint8_t* rgbPixels = new uint8_t[SCRWIDTH * SCRHEIGHT * 3];
-	for (int i = 0; i < SCRWIDTH * SCRHEIGHT; i++) {
+	uint8_t* rgbPixels = new uint8_t[screenWidth * screenHeight * 3];
+	for (int i = 0; i < screenWidth * screenHeight; i++) {
 		uint32_t pixel = screen->pixels[i];
 		uint8_t r = (pixel >> 16) & 0xFF;
 		uint8_t g = (pixel >> 8) & 0xFF;
@@ -456,12 +1154,23 @@ void Tmpl8::Renderer::Capture()
 		rgbPixels[i * 3 + 1] = g;
 		rgbPixels[i * 3 + 2] = b;
 	}
-	std::ostringstream ss;
-	ss << "../assets/captures/capture_" << std::put_time(std::localtime(&end_time), "%Y-%m-%d_%H-%M-%S") << ".png";
+	stbi_write_png(fileName, screenWidth, screenHeight, 3, rgbPixels, screenWidth * 3);
+	delete[] rgbPixels;
+}
 
-	stbi_write_png(ss.str().c_str(), SCRWIDTH, SCRHEIGHT, 3, rgbPixels, SCRWIDTH * 3);
+void Tmpl8::Renderer::SaveAccumulator(const char* fileName)
+{
+	// Store the per-pixel averages as linear float RGB
+	float* rgbPixels = new float[screenWidth * screenHeight * 3];
+	for (int i = 0; i < screenWidth * screenHeight; i++)
+	{
+		const float4 average = accumulator.Average(i);
+		rgbPixels[i * 3 + 0] = average.x;
+		rgbPixels[i * 3 + 1] = average.y;
+		rgbPixels[i * 3 + 2] = average.z;
+	}
+	stbi_write_hdr(fileName, screenWidth, screenHeight, 3, rgbPixels);
 	delete[] rgbPixels;
-	CAPTURE = false;
 }
 
 void Tmpl8::Renderer::Debug(Timer t)
@@ -470,12 +1179,12 @@ void Tmpl8::Renderer::Debug(Timer t)
 	avg = (1 - alpha) * avg + alpha * t.elapsed() * 1000;
 	if (alpha > 0.05f) alpha *= 0.5f;
 	fps = 1000.0f / avg;
-	rps = (SCRWIDTH * SCRHEIGHT) / avg;
+	rps = (screenWidth * screenHeight) / avg;
 }
 
 void Renderer::UI()
 {
-#if  GAMETYPE == DEBUGMODE
+#if  GAMETYPE == DEBUGMODE && !defined(HEADLESS)
 	userInterface->UI();
 #else
 
@@ -495,7 +1204,8 @@ void Tmpl8::Renderer::MouseDown(int button)
 
 void Tmpl8::Renderer::MouseMove(int x, int y)
 {
-	mousePos.x = x, mousePos.y = y;
+	// The window keeps its startup size, map it onto the current resolution
+	mousePos.x = x * screenWidth / SCRWIDTH, mousePos.y = y * screenHeight / SCRHEIGHT;
 }
 
 void Tmpl8::Renderer::MouseWheel(float y)
@@ -1,13 +1,32 @@
 ﻿#pragma once
 #include "Scene.h"
-#include "UserInterface.h"
 #include "btBulletDynamicsCommon.h"
-#include "DebugDrawer.h"
 #include "ContactCallback.h"
+#include "TileScheduler.h"
+#include "ShadowBatch.h"
+#include "Wavefront.h"
+#include "FrameGovernor.h"
+#include "Denoiser.h"
+#include "PostProcess.h"
+#include "Accumulator.h"
+#include "Sampler.h"
+#include "Emitters.h"
+#include "SkyLight.h"
+#include "LightTree.h"
+#include "SimdLights.h"
+#include "AliasTable.h"
+#include "Reservoir.h"
+#ifndef HEADLESS
+#include "UserInterface.h"
+#include "DebugDrawer.h"
 #include <Audio/Sound.hpp>
+#endif
 
 namespace Tmpl8
 {
+#ifdef HEADLESS
+class UserInterface;
+#endif
 
 class Renderer : public TheApp
 {
@@ -34,6 +53,9 @@ public:
 
 	// IMGUI Rendering Options
 	int bounces = 2;
+	int spp = 2; // Primary samples per pixel per frame when AA is enabled
+	bool RUSSIANROULETTE = true;
+	int rouletteDepth = 3; // Bounces a path always survives before Russian roulette may end it
 	enum class RENDER_STATES
 	{
 		BRDF,
@@ -43,13 +65,20 @@ public:
 		METAL,
 		ROUGHNESS,
 		EMMISIVE,
+		SAMPLEHEATMAP,
 	};
 	RENDER_STATES renderingMode = RENDER_STATES::BRDF;
 	bool AUDIOPLAYING = true, LIGHTED = true, GAMMACORRECTED = true, NORMALMAPPED = true, SKYBOX = true, COLLIDERS = false, CAPTURE = false, AA = true, isPostProcessed = false, isStochastic = true;
 	bool DEBUG = false, callDebugBreak = false;
+	bool PACKETS = true; // Primary visibility in 16x16 ray packets
+	bool DEFERSHADOWS = true, SORTSHADOWS = true; // Queue shadow rays per pixel block and trace them in one batch
+	bool WAVEFRONT = false; // Trace in breadth-first stages over ray queues instead of a path per pixel
+	bool DENOISE = false; // Edge-avoiding a-trous filter over the accumulated frame, guided by the primary hits
 	
 	// Bullet Physics
+#ifndef HEADLESS
 	DebugDrawer* debugger = new DebugDrawer();
+#endif
 	btDefaultCollisionConfiguration* collisionConfig;
 	btCollisionDispatcher* dispatcher;
 	btBroadphaseInterface* broadphase;
@@ -58,20 +87,103 @@ public:
 
 	int2 mousePos;
 
-	int samplesPerPixel[1280 * 720] = { 1 };
-	float distances[1280 * 720] = { -1.f };
-	float4* accumulator;
+	// Screen Resolution: every per-pixel buffer below holds screenWidth x screenHeight entries, see SetResolution
+	int screenWidth = SCRWIDTH, screenHeight = SCRHEIGHT;
+	std::vector<float> distances;
+	AccumulatorFormat accumulatorFormat = AccumulatorFormat::FLOAT4;
+	Accumulator accumulator; // Average and frame count per pixel
+	bool VERIFYACCUMULATOR = false; // Feed the same results to a float accumulator to measure the packed formats' error
+	Accumulator referenceAccumulator;
+
+	// Adaptive Sampling
+	bool ADAPTIVE = false;
+	float adaptiveThreshold = 0.02f; // Relative standard error of a pixel's mean luminance below which it counts as converged
+	int adaptiveMinFrames = 8; // Frames a pixel is always sampled before it may converge
+	int adaptiveMaxScale = 4; // The noisiest pixels trace up to this many times the regular samples per frame
+	int adaptiveFrames = 0; // Frames since the accumulator was cleared
+
+	// Texture LOD: every path carries a ray cone, widened by its bounces, whose width at a hit picks the mip level
+	// its textures are read from; far and diffusely reached hits read small levels that stay in cache
+	bool TEXTURELOD = true;
+	float pixelSpread = 0.f; // Spread angle of a camera ray's cone, one render pixel wide; set every frame
+
+	// Sampling: every random decision of a path is a dimension of its pixel's current sample, see Sampler
+	Sampler sampler;
+	uint sampleEpoch = 0; // Counts accumulation restarts, each one continues with a fresh scramble
+
+	// Multiple importance sampling: emissive triangles are sampled as lights too, and the light sample and a bounce
+	// that hits the same emitter are weighted by their pdfs. OFF only finds emitters by hitting them
+	enum class MIS_HEURISTIC { OFF, BALANCE, POWER };
+	MIS_HEURISTIC misHeuristic = MIS_HEURISTIC::POWER;
+	Emitters emitters;
+	SkyLight skyLight; // The skydome is sampled like the emitters and weighted against the bounces that escape to it
+
+	// Light tree: the point lights, spot lights and bulbs in one BVH, a shading point samples one of them with one
+	// shadow ray. Without it the SIMD point lights are evaluated together and the first spot light on its own
+	bool LIGHTTREE = true;
+	std::vector<TreeLight> bulbs; // Small emitters such as pinball bulbs and LEDs, only the light tree samples them
+	std::vector<TreeLight> treeLights; // Gathered every frame, the tree only rebuilds when they changed
+	LightTree lightTree;
+	SimdLights simdPointLights; // The point lights the light tree is off for, evaluated together by SampleDirectLight
+	float spotCosCutoff = 0.9f; // Cosine of the spot lights' cone half angle
+
+	// Light selection: stochastic lighting picks the light type to sample in proportion to the power it emits, through
+	// an alias table that is only rebuilt when a light's power changes. The directional light counts the power it
+	// sends through the scene's cross section
+	enum class LIGHT_TYPES { POINTS, DIRECTIONAL, SPOT, TREE, AREA };
+	std::vector<LIGHT_TYPES> lightTypes; // Type of every entry of the table
+	std::vector<float> lightPowers;
+	AliasTable lightSelection;
+	float sceneRadius = 1.f; // Half the diagonal of the scene's bounds when it was loaded
+
+	// ReSTIR: a primary hit resamples its direct light from a few fresh candidates plus the reservoirs its own and some
+	// random neighboring pixels kept last frame, then traces a single shadow ray. Candidates come from the light tree and
+	// the directional light; the hit is reprojected into last frame's view to find its pixel there, and reuse is
+	// rejected across depth and normal edges
+	bool RESTIR = false;
+	int restirCandidates = 8; // Fresh light candidates per primary hit
+	int restirNeighbors = 3; // Reservoirs of last frame's neighbors fed in
+	int restirRadius = 16; // In render pixels
+	int restirHistory = 20; // A reused reservoir counts for at most this many times the fresh candidates
+	std::vector<Reservoir> reservoirs, previousReservoirs; // Per screen pixel, like the accumulator; only held while RESTIR is on
+	uint reservoirFrame = 0; // Counts the frames rendered with reservoirs
+	Camera::View reservoirView, previousReservoirView; // The views this and last frame's reservoirs were built in
+
+	// Reprojection: when the camera moves the accumulated history follows the surfaces instead of being cleared
+	bool REPROJECT = true;
+	int reprojectMaxFrames = 32; // Reprojected history is clamped to this many frames so resampling blur fades out
+	float reprojectTolerance = 0.02f; // Relative depth difference that still counts as the same surface
+	bool reprojectPending = false; // The frame being rendered reads its history from the previous view
+	Camera::View previousView;
+	Accumulator historyAccumulator;
+	std::vector<int> historySamplesTaken;
+	std::vector<float> historyDistances, historyLuminanceSquares;
+
+	// Render Resolution: pixels are traced on a renderWidth x renderHeight grid and fill their block of the screen
+	float renderScale = 1.f;
+	int renderWidth = SCRWIDTH, renderHeight = SCRHEIGHT;
+	int ScreenX(const int x) const { return x * screenWidth / renderWidth; }
+	int ScreenY(const int y) const { return y * screenHeight / renderHeight; }
+	int RenderX(const int x) const { return (x * renderWidth + screenWidth - 1) / screenWidth; } // inverse of ScreenX
+	int RenderY(const int y) const { return (y * renderHeight + screenHeight - 1) / screenHeight; }
+	std::vector<float> luminanceSquares; // Running sum of squared per-frame luminance
+	std::vector<int> samplesTaken; // Samples traced since the accumulator was cleared
 
 	float dT; //deltaTime
 	float avg = 10, alpha = 1, fps, rps;
 	
 	Scene scene;
 	Camera camera;
+	TileScheduler scheduler;
+	Wavefront wavefront;
+	FrameGovernor governor;
+	Denoiser denoiser;
+	PostProcess postProcess;
 	UserInterface* userInterface;
 
 	PhysicsObject* Spaceship = nullptr;
 
-	// SIMD Lights
+	// Point Lights, edited through the UI and evaluated by the SIMD light kernels
 	union Vec4f {
 		__m128 vec;
 		float f[4];
@@ -90,12 +202,71 @@ public:
 	void Init();
 	void Tick(float deltaTime);
 	void Shutdown();
-	float3 Trace(tinybvh::Ray& ray, int recursionCap = 0);
+	void SetResolution(const int width, const int height); // (Re)allocates the screen and every per-pixel buffer
+	void SetAccumulatorFormat(const AccumulatorFormat format);
+	void RenderTile(const Tile& tile);
+	void RenderPixel(const int renderX, const int renderY);
+	void RenderPacket(const int x0, const int y0);
+	// features receives the primary hit's guide features for the denoiser
+	float3 Trace(tinybvh::Ray& ray, DenoiseFeatures* features = nullptr);
+	float3 Shade(tinybvh::Ray& ray, DenoiseFeatures* features = nullptr); // Trace for a ray that was already intersected
+	void ResetAccumulation();
+	void BeginReprojection(const Camera::View& view);
+	bool ReprojectHistory(const int x, const int y, const float primaryDistance, float4& history, int& frames, float& luminanceSquare, int& taken);
+	void FillBlock(const int x, const int y);
+	// sampleCount is the number of samples averaged in traceResult, 0 keeps a converged pixel's accumulated result
+	void StorePixel(const int x, const int y, float3 traceResult, const float primaryDistance, const int sampleCount = 1);
+	void OutputPixel(const int x, const int y, const float4& average); // Hands a render pixel's block to the post-processing pass
+	bool Denoising() const { return DENOISE && !DEBUG && renderingMode != RENDER_STATES::SAMPLEHEATMAP; }
+	void StoreFeatures(const int renderPixel, DenoiseFeatures features);
+	void Denoise();
+	int AdaptiveSamples(const int pixel) const; // Samples to trace this frame, 0 when converged
+	// The pixel's s-th sample of this frame, counted on from the samples it has accumulated
+	uint SampleIndex(const int pixel, const int s) const { return (uint)(samplesTaken[pixel] + s); }
+	void BeginSample(const int pixel, const uint index, const int depth = 0); // Points the calling thread at a path
+	float Random(const BounceDimension dimension) const; // Dimension of the current path's current bounce
+	float2 Jitter() const; // Subpixel offset of the current sample, in [0, 1)
+
+	// Path tracing building blocks, shared by Trace and the wavefront stages
+	bool DebugView(const MaterialProperties& material, const float3& geometryNormal, const float3& shadingNormal, float3& color) const;
+	// Direct light of a hit at the given depth and distance: the primary hit resamples it when Resampling, others use SampleDirectLight
+	int SampleLights(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const int depth, const float distance, ShadowSample samples[HITSHADOWSAMPLES]);
+	int SampleDirectLight(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, ShadowSample samples[POINTLIGHTS]);
+	// One area light picked by power with random number u, probability is the share of the area lights in the light pick.
+	// Traces the light's stratified points, solid angle pdf: distance² / (cos at the light * area)
+	int SampleAreaLight(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const float u, const float probability, ShadowSample samples[POINTLIGHTS]) const;
+	float AreaLightPower(const AreaLight& light) const;
+	// One light picked by the light tree with random number u, probability is the share of the tree in the light pick
+	int SampleLightTree(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const float u, const float probability, ShadowSample& sample) const;
+	bool RussianRoulette(const int depth, float3& throughput) const;
+	// pdf receives the solid angle pdf of the bounce direction, 0 when it was a delta choice no light sample can match
+	bool SampleBounce(const float3& D, const float3& I, const float3& shadingNormal, const float3& geometryNormal, const MaterialProperties& material, tinybvh::Ray& bounceRay, float3& weight, float& pdf);
+	float SpecularProbability(const MaterialProperties& material, const float3& V, const float3& shadingNormal) const; // SampleBounce's lobe pick
+	bool SampleEmitter(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const bool lastBounce, ShadowSample& sample);
+	float ConeSpread(const float spread, const float bouncePdf) const; // Spread angle of a ray cone after a bounce
+	bool Resampling() const { return RESTIR && isStochastic; } // The primary hit samples its direct light through SampleReservoir
+	// Light kept by the current pixel's reservoir, with one shadow ray; depth is the primary hit's distance
+	int SampleReservoir(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const float depth, ShadowSample& sample);
+	// Render pixel that saw hit point I of screen pixel `pixel` last frame, as ReprojectHistory finds the history
+	bool ReprojectReservoir(const float3& I, const int pixel, int& renderX, int& renderY) const;
+	// A tree light or the directional light, picked like SampleDirectLight would; -1 when nothing or an area light was picked
+	int SampleLightCandidate(const float3& I, const float3& shadingNormal, const float u, float& pmf) const;
+	// Unshadowed light a tree light, or the directional light at index lightTree.Size(), reflects towards V
+	float3 EvaluateLight(const int light, const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, float3& L, float& distance) const;
+	bool SampleSky(const float3& I, const float3& shadingNormal, const float3& V, const MaterialProperties& material, const bool lastBounce, ShadowSample& sample);
+	float SkyWeight(const float3& D, const float bouncePdf) const; // MIS weight of the sky seen by a bounce with the given pdf
+	// MIS weight of emission reached by a bounce with the given pdf, ray holds the hit on the emitter
+	float EmissionWeight(const tinybvh::Ray& ray, const float3& geometryNormal, const float bouncePdf) const;
+	float MISWeight(const float pdf, const float otherPdf) const;
 
 	// Utilities
 	void InitLights();
+	void GatherLights(); // Fills treeLights from the point lights, spot lights and bulbs
+	void UpdateLightSelection();
 	void InitPhysics();
 	void Capture();
+	void SaveScreen(const char* fileName);
+	void SaveAccumulator(const char* fileName);
 	void Debug(Timer t);
 	void UI();
 
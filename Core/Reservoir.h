@@ -0,0 +1,26 @@
+#pragma once
+
+// Weighted reservoir of light samples for ReSTIR direct lighting (Bitterli et al. 2020): streams any number of
+// candidates and keeps one, each with a probability proportional to its weight, in constant memory. A
+// reservoir can be fed to another one, which is what lets pixels reuse their neighbors' and their past samples.
+struct Reservoir
+{
+	int light = -1; // the kept light, see Renderer::EvaluateLight
+	float weightSum = 0.f; // of all candidates streamed through
+	float M = 0.f; // candidates streamed through, counting those of the reservoirs that were fed in
+	float W = 0.f; // unbiased contribution weight of the kept light: its estimate is its contribution times W
+
+	// Primary hit the reservoir was built for, other pixels only reuse it on a similar surface
+	float3 normal = float3(0.f);
+	float depth = -1.f;
+	uint frame = 0; // Renderer::reservoirFrame it was written in, older ones count as cleared
+
+	// Streams in one candidate with its resampling weight, u decides whether it replaces the kept one
+	bool Update(const int candidate, const float weight, const float u)
+	{
+		weightSum += weight;
+		if (weight <= 0.f || u * weightSum >= weight) return false;
+		light = candidate;
+		return true;
+	}
+};
@@ -0,0 +1,97 @@
+#include "precomp.h"
+#include "Sampler.h"
+
+// Direction numbers of the first four Sobol dimensions, from the primitive polynomials of Joe & Kuo
+struct SobolDirections
+{
+	uint v[4][32];
+
+	SobolDirections()
+	{
+		// Degree s, polynomial coefficients a and initial numbers m of dimensions 1..3; dimension 0 is the van der Corput sequence
+		const int degree[4] = { 0, 1, 2, 3 }, coefficients[4] = { 0, 0, 1, 1 };
+		const uint initial[4][3] = { {}, { 1 }, { 1, 3 }, { 1, 3, 1 } };
+		for (int k = 0; k < 32; k++) v[0][k] = 1u << (31 - k);
+		for (int d = 1; d < 4; d++)
+		{
+			const int s = degree[d];
+			for (int k = 0; k < 32; k++)
+			{
+				if (k < s)
+				{
+					v[d][k] = initial[d][k] << (31 - k);
+					continue;
+				}
+				v[d][k] = v[d][k - s] ^ (v[d][k - s] >> s);
+				for (int i = 1; i < s; i++)
+					if ((coefficients[d] >> (s - 1 - i)) & 1) v[d][k] ^= v[d][k - i];
+			}
+		}
+	}
+};
+static const SobolDirections directions;
+
+static uint Sobol(uint index, const int dimension)
+{
+	uint result = 0;
+	for (int bit = 0; index; bit++, index >>= 1)
+		if (index & 1) result ^= directions.v[dimension][bit];
+	return result;
+}
+
+static uint ReverseBits(uint x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	return ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+}
+
+// Integer hash with good avalanche (Wellons' lowbias32)
+static uint Hash(uint x)
+{
+	x ^= x >> 16, x *= 0x7feb352du;
+	x ^= x >> 15, x *= 0x846ca68bu;
+	return x ^ (x >> 16);
+}
+
+static uint HashCombine(const uint seed, const uint value)
+{
+	return seed ^ (Hash(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+// Owen scrambling: every bit is flipped depending only on the bits above it. On the reversed value
+// that is a hash whose bits only depend on lower bits, which multiplications by even constants give.
+static uint OwenScramble(uint x, const uint seed)
+{
+	x = ReverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return ReverseBits(x);
+}
+
+static float ToUnitFloat(const uint x)
+{
+	// The top 24 bits, so the result never rounds up to 1
+	return (x >> 8) * (1.f / 16777216.f);
+}
+
+float Sampler::Get(const uint pixel, const uint index, const uint dimension) const
+{
+	const uint pixelSeed = HashCombine(Hash(seed), pixel);
+	if (type == SamplerType::RANDOM) return ToUnitFloat(Hash(HashCombine(HashCombine(pixelSeed, index), dimension)));
+
+	// Shuffling the index per group decorrelates the groups, scrambling the values decorrelates the pixels
+	const uint groupSeed = HashCombine(pixelSeed, dimension / 4);
+	const uint shuffled = OwenScramble(index, groupSeed);
+	return ToUnitFloat(OwenScramble(Sobol(shuffled, dimension % 4), HashCombine(groupSeed, dimension % 4 + 1)));
+}
+
+const char* Sampler::TypeName(const SamplerType type)
+{
+	return type == SamplerType::RANDOM ? "random" : "sobol";
+}
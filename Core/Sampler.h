@@ -0,0 +1,36 @@
+#pragma once
+
+enum class SamplerType
+{
+	RANDOM, // hashed white noise
+	SOBOL, // Owen-scrambled Sobol
+};
+
+// Dimensions a path draws from. The pixel jitter owns the first group of four, then every bounce
+// gets BOUNCEDIMENSIONS of its own. Sobol points are stratified within a group of four, so the
+// two halves of a 2D sample always sit in the same group.
+enum PixelDimension { JITTER_X, JITTER_Y, PIXELDIMENSIONS = 4 };
+enum BounceDimension { LIGHT_PICK, LIGHT_SPECULAR, BOUNCE_PICK, ROULETTE, BOUNCE_U, BOUNCE_V, EMITTER_U, EMITTER_V, EMITTER_PICK, RESERVOIR_SEED, AREA_U, AREA_V, SKY_U, SKY_V, BOUNCEDIMENSIONS = 16 };
+
+// Sample values as a pure function of (pixel, sample index, dimension), so a render does not depend
+// on which thread traced which pixel. Following Burley's hash-based Owen scrambling, dimensions are
+// padded from 4D Sobol sets: every group of four gets its own index shuffle and scramble per pixel.
+class Sampler
+{
+public:
+	SamplerType type = SamplerType::SOBOL;
+	uint seed = 0; // a different seed gives a different, equally reproducible image
+
+	// Value in [0, 1) of one dimension of a pixel's index-th sample
+	float Get(const uint pixel, const uint index, const uint dimension) const;
+	static const char* TypeName(const SamplerType type);
+};
+
+// Pixel and sample of the path the current thread traces; the path tracing building blocks draw
+// their decisions through it instead of passing both through every signature
+struct SampleContext
+{
+	uint pixel = 0, index = 0;
+	int depth = 0;
+	int screenPixel = 0; // the pixel itself, pixel is the key the scramble is hashed from
+};
@@ -14,7 +14,7 @@ void Scene::Init()
 	/* 0 */ AddModel(modelsPath + "SciFiHelmet/SciFiHelmet.gltf", "SciFiHelmet", ".png");
 
 	// 2. Build BVH's (Each Model One BVH)
-	for (auto model: models) bvh.push_back(model->modelBVH);
+	for (auto model: models) bvh.push_back(model->modelBVH), packetBVH.push_back(model->packetBVH);
 
 	// 3. Use Serialized JSON's to populate scene with GameObjects and BLASES
 	FindSerialized(gameObjectsPath, ".json", 0);
@@ -25,6 +25,7 @@ void Scene::Init()
 	// 5. Use Serialized JSON's to populate scene with lights
 	FindSerialized(dirPrefabPath, ".json", 2); // dirLight
 	FindSerialized(spotPrefabPath, ".json", 3); // spotLight
+	if (filesystem::exists(areaPrefabPath)) FindSerialized(areaPrefabPath, ".json", 4); // areaLight, older scenes have none
 }
 
 Scene::~Scene()
@@ -44,6 +45,69 @@ bool Scene::IsOccluded(tinybvh::Ray& ray) const
 	return false;
 }
 
+void Scene::IntersectPacket(tinybvh::Ray* packet) const
+{
+	// Packet version of BVH::IntersectTLAS for PACKETSIZE x PACKETSIZE rays sharing one origin, ordered like
+	// tinybvh's Intersect256Rays expects (4x4 blocks of 4x4 rays). The packet walks the TLAS as a whole;
+	// every instance it reaches is traced by transforming the packet into object space.
+	constexpr int count = PACKETSIZE * PACKETSIZE;
+	const float3 O = packet[0].O;
+	float3 D[count];
+	for (int i = 0; i < count; i++) D[i] = packet[i].D;
+
+	// A node is visited when any ray of the packet still hits its bounds before its closest hit
+	auto packetHits = [&](const tinybvh::BVH::BVHNode& node)
+		{
+			for (int i = 0; i < count; i++)
+				if (node.Intersect(packet[i]) < BVH_FAR) return true;
+			return false;
+		};
+
+	const tinybvh::BVH::BVHNode* node = &tlas.bvhNode[0], * stack[64];
+	uint stackPtr = 0;
+	if (!packetHits(*node)) return;
+	while (1)
+	{
+		if (node->isLeaf())
+		{
+			for (uint j = 0; j < node->triCount; j++)
+			{
+				const uint instIdx = tlas.primIdx[node->leftFirst + j];
+				const tinybvh::BLASInstance& inst = tlas.instList[instIdx];
+
+				// Transformed rays keep their length, so hit distances stay valid in world space
+				const float3 objectO = tinybvh::tinybvh_transform_point(O, inst.invTransform);
+				for (int i = 0; i < count; i++)
+				{
+					packet[i].O = objectO;
+					packet[i].D = tinybvh::tinybvh_transform_vector(D[i], inst.invTransform);
+					packet[i].rD = tinybvh::tinybvh_safercp(packet[i].D);
+					packet[i].instIdx = instIdx;
+				}
+#ifdef BVH_USEAVX
+				packetBVH[inst.blasIdx]->Intersect256RaysSSE(packet);
+#else
+				packetBVH[inst.blasIdx]->Intersect256Rays(packet);
+#endif
+			}
+
+			// Back to world space for the remaining TLAS nodes
+			for (int i = 0; i < count; i++)
+				packet[i].O = O, packet[i].D = D[i], packet[i].rD = tinybvh::tinybvh_safercp(D[i]);
+
+			if (stackPtr == 0) break; else node = stack[--stackPtr];
+			continue;
+		}
+		const tinybvh::BVH::BVHNode* child1 = &tlas.bvhNode[node->leftFirst];
+		const tinybvh::BVH::BVHNode* child2 = &tlas.bvhNode[node->leftFirst + 1];
+		const bool hit1 = packetHits(*child1), hit2 = packetHits(*child2);
+		if (hit1 && hit2) node = child1, stack[stackPtr++] = child2;
+		else if (hit1) node = child1;
+		else if (hit2) node = child2;
+		else if (stackPtr == 0) break; else node = stack[--stackPtr];
+	}
+}
+
 float3 Scene::GetGeometryNormal(tinybvh::Ray& ray)
 {
 	float3 faceNormal = models[gameobjects[ray.hit.inst]->modelIndex]->faceNormals[ray.hit.prim];
@@ -57,7 +121,7 @@ float3 Scene::GetGeometryNormal(tinybvh::Ray& ray)
 	return faceNormal;
 }
 
-float3 Scene::GetShadingNormal(tinybvh::Ray& ray)
+float3 Scene::GetShadingNormal(tinybvh::Ray& ray, const float lod)
 {
 	int whatModel = gameobjects[ray.hit.inst]->modelIndex;
 
@@ -76,13 +140,7 @@ float3 Scene::GetShadingNormal(tinybvh::Ray& ray)
 			+ u * models[whatModel]->fixedTextureCoords[triangleV1]
 			+ w * models[whatModel]->fixedTextureCoords[triangleV0];
 
-		int texWidth = models[whatModel]->albedoTexture->width;
-		int texHeight = models[whatModel]->albedoTexture->height;
-
-		int iu = static_cast<int>((uv.x * texWidth)) % texWidth;
-		int iv = static_cast<int>((uv.y * texHeight)) % texHeight;
-
-		uint normalTexel = models[whatModel]->normalTexture->pixels[iu + iv * texWidth];
+		uint normalTexel = models[whatModel]->normalMips.Texel(uv, static_cast<int>(lod + 0.5f));
 		normalColor = MakeNormalFromTexel(normalTexel);
 
 		int triangleIndex = triangleV0; // Convert primitive index to vertex index
@@ -137,7 +195,7 @@ float3 Scene::GetShadingNormal(tinybvh::Ray& ray)
 	}
 }
 
-MaterialProperties Scene::GetMaterialBRDF(tinybvh::Ray& ray) const
+MaterialProperties Scene::GetMaterialBRDF(tinybvh::Ray& ray, const float lod) const
 {
 	int whatModel = gameobjects[ray.hit.inst]->modelIndex;
 	Model* modelPtr = models[whatModel];
@@ -157,24 +215,19 @@ MaterialProperties Scene::GetMaterialBRDF(tinybvh::Ray& ray) const
 		+ u * modelPtr->fixedTextureCoords[triangleV1]
 		+ w * modelPtr->fixedTextureCoords[triangleV0];
 	
-	int texWidth = modelPtr->albedoTexture->width;
-	int texHeight = modelPtr->albedoTexture->height;
-
-	int iu = (int)(uv.x * texWidth) % texWidth;
-	int iv = (int)(uv.y * texHeight) % texHeight;
-	int whatPixel = iu + iv * texWidth;
+	const int level = static_cast<int>(lod + 0.5f);
 
 	// Base Color (First Texture)
 	if (modelPtr->albedoTexture != nullptr)
 	{
-		uint basecolorTexel = modelPtr->albedoTexture->pixels[whatPixel];
+		uint basecolorTexel = modelPtr->albedoMips.Texel(uv, level);
 		base = SrgbToLinear(MakeColorFromTexel(basecolorTexel));
 	}
 
 	// RMA
 	if (modelPtr->metalnessTexture != nullptr)
 	{
-		uint rmaTexel = modelPtr->metalnessTexture->pixels[whatPixel];
+		uint rmaTexel = modelPtr->metalnessMips.Texel(uv, level);
 
 		roughness = ExtractChannel(channel::GREEN, rmaTexel);
 		metalness = ExtractChannel(channel::BLUE, rmaTexel);
@@ -183,7 +236,7 @@ MaterialProperties Scene::GetMaterialBRDF(tinybvh::Ray& ray) const
 	// Emmision (Fourth Texture)
 	if (modelPtr->emissionTexture != nullptr)
 	{
-		uint emissionTexel = modelPtr->emissionTexture->pixels[whatPixel];
+		uint emissionTexel = modelPtr->emissionMips.Texel(uv, level);
 		emission = MakeColorFromTexel(emissionTexel);
 	}
 
@@ -217,6 +270,36 @@ MaterialProperties Scene::GetMaterialBRDF(tinybvh::Ray& ray) const
 	return result;
 }
 
+float Scene::TextureLOD(const tinybvh::Ray& ray, const float coneWidth) const
+{
+	const Model* model = models[gameobjects[ray.hit.inst]->modelIndex];
+	if (coneWidth <= 0.f || model->albedoTexture == nullptr) return 0.f;
+
+	// Twice the triangle's area in world space and in texels, their ratio is the texel density squared
+	const uint v0 = ray.hit.prim * 3;
+	const float* transform = blases[ray.hit.inst].transform;
+	const float3 p0 = tinybvh::tinybvh_transform_point(model->triangles[v0], transform);
+	const float3 p1 = tinybvh::tinybvh_transform_point(model->triangles[v0 + 1], transform);
+	const float3 p2 = tinybvh::tinybvh_transform_point(model->triangles[v0 + 2], transform);
+	const float3 normal = cross(p1 - p0, p2 - p0);
+	const float worldArea = length(normal);
+	const float2 t1 = model->fixedTextureCoords[v0 + 1] - model->fixedTextureCoords[v0], t2 = model->fixedTextureCoords[v0 + 2] - model->fixedTextureCoords[v0];
+	const float texelArea = fabsf(t1.x * t2.y - t2.x * t1.y) * model->albedoTexture->width * model->albedoTexture->height;
+	if (worldArea <= 0.f || texelArea <= 0.f) return 0.f;
+
+	// A grazing cone stretches over more of the surface
+	const float cosine = max(fabsf(dot(normal / worldArea, ray.D)), 0.05f);
+	return max(0.5f * log2f(texelArea / worldArea) + log2f(coneWidth / cosine), 0.f);
+}
+
+void Scene::TextureMemory(size_t& stored, size_t& uncompressed) const
+{
+	stored = uncompressed = 0;
+	for (const Model* model : models)
+		for (const MipChain* chain : { &model->albedoMips, &model->normalMips, &model->metalnessMips, &model->emissionMips })
+			stored += chain->Bytes(), uncompressed += chain->UncompressedBytes();
+}
+
 void Scene::BuildTLAS()
 {
 	tlas.Build(blases.data(), static_cast<uint32_t>(blases.size()), bvh.data(), static_cast<uint32_t>(bvh.size()));
@@ -276,7 +359,7 @@ void Scene::applyImpulse(btRigidBody* body, const float Impulse)
 	body->applyCentralImpulse(impulse);
 }
 
-void Scene::FindSerialized(const std::string wherePath, const std::string whatExtension, const int jsonType) // jsonType: (0) = GameObject, (1) = pointLight, (2) = dirLight, (3) = spotLight
+void Scene::FindSerialized(const std::string wherePath, const std::string whatExtension, const int jsonType) // jsonType: (0) = GameObject, (1) = pointLight, (2) = dirLight, (3) = spotLight, (4) = areaLight
 {
 	// https://stackoverflow.com/questions/10681112/extracting-a-string-in-between-symbols
 	// https://www.geeksforgeeks.org/cpp-program-to-get-the-list-of-files-in-a-directory/
@@ -310,6 +393,8 @@ void Scene::FindSerialized(const std::string wherePath, const std::string whatEx
 						AddLight("directionallight", true);
 					else if (jsonType == 3)
 						AddLight("spotlight", true);
+					else if (jsonType == 4)
+						areaLights.push_back(new AreaLight(result.substr(0, end_position), "scene1", true)); // a scene has several, each file is one
 				}
 			}
 		}
@@ -322,6 +407,8 @@ void Scene::AddLight(std::string lightType, bool exists)
 		directionalLights.push_back(new DirectionalLight("directionallight", "scene1", exists));
 	if (lightType == "spotlight")
 		spotlights.push_back(new SpotLight("spotlight", "scene1", exists));
+	if (lightType == "arealight")
+		areaLights.push_back(new AreaLight("arealight", "scene1", exists));
 }
 
 void Scene::AddBLAS(int index)
@@ -17,6 +17,7 @@ public:
 	~Scene();
 
 	std::vector <tinybvh::BVHBase*> bvh = { };      
+	std::vector <tinybvh::BVH*> packetBVH = { }; // Same order as bvh, used by IntersectPacket
 
 	std::vector<tinybvh::BLASInstance> blases = { };
 
@@ -31,6 +32,7 @@ public:
 	// Lights
 	std::vector<DirectionalLight*> directionalLights;
 	std::vector<SpotLight*> spotlights;
+	std::vector<AreaLight*> areaLights;
 
 	// Paths
 	const std::string modelsPath = "../assets/prefabs/models/";
@@ -38,6 +40,7 @@ public:
 	const std::string pointPrefabPath = "../assets/scene1/pointlights/";
 	const std::string dirPrefabPath = "../assets/scene1/directionallights/";
 	const std::string spotPrefabPath = "../assets/scene1/spotlights/";
+	const std::string areaPrefabPath = "../assets/scene1/arealights/";
 	const std::string lightPath = "../assets/scene1/";
 
 	void Init();
@@ -48,9 +51,16 @@ public:
 
 	// Tracing Rays:
 	bool IsOccluded(tinybvh::Ray& ray) const;
+	void IntersectPacket(tinybvh::Ray* packet) const;
 	float3 GetGeometryNormal(tinybvh::Ray& ray);
-	float3 GetShadingNormal(tinybvh::Ray& ray);
-	MaterialProperties GetMaterialBRDF(tinybvh::Ray& ray) const;
+	// Texture lookups read mip level lod (rounded), see TextureLOD
+	float3 GetShadingNormal(tinybvh::Ray& ray, const float lod = 0.f);
+	MaterialProperties GetMaterialBRDF(tinybvh::Ray& ray, const float lod = 0.f) const;
+	// Mip level of a hit seen through a ray cone of the given width (Akenine-Moller et al., ray cones): the texels
+	// per unit of the triangle's world space length, times the width the cone covers on it
+	float TextureLOD(const tinybvh::Ray& ray, const float coneWidth) const;
+	// Bytes of every model's mip chains as stored, and as they would be in RGBA8
+	void TextureMemory(size_t& stored, size_t& uncompressed) const;
 
 	void BuildTLAS();
 
@@ -1,4 +1,6 @@
 #include "precomp.h"
+
+#ifndef HEADLESS
 #include "ShaderClass.h"
 
 ShaderClass::ShaderClass(const char* path, const string vertexName, const string fragmentName)
@@ -100,3 +102,5 @@ void ShaderClass::checkCompileErrors(unsigned int shader, std::string type)
 		}
 	}
 }
+
+#endif // HEADLESS
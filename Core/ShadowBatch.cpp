@@ -0,0 +1,34 @@
+#include "precomp.h"
+#include "ShadowBatch.h"
+
+void ShadowBatch::Push(const ShadowSample& sample, const float3& weight)
+{
+	// Key: light in the high bits, direction octant in the low 3 bits
+	const float3& D = sample.direction;
+	const uint octant = (D.x < 0 ? 1 : 0) | (D.y < 0 ? 2 : 0) | (D.z < 0 ? 4 : 0);
+	entries.push_back(Entry{ sample.origin, sample.distance, sample.direction, target, sample.contribution * weight, (uint)sample.light * 8 + octant });
+}
+
+void ShadowBatch::Resolve(const Scene& scene, float3* results)
+{
+	const std::vector<Entry>* batch = &entries;
+	if (sorted && entries.size() > 1)
+	{
+		// Counting sort, there are only (SKYLIGHT + 1) * 8 keys
+		constexpr int keyCount = (SKYLIGHT + 1) * 8;
+		int offsets[keyCount + 1] = {};
+		for (const Entry& e : entries) offsets[e.key + 1]++;
+		for (int k = 0; k < keyCount; k++) offsets[k + 1] += offsets[k];
+		sortedEntries.resize(entries.size());
+		for (const Entry& e : entries) sortedEntries[offsets[e.key]++] = e;
+		batch = &sortedEntries;
+	}
+
+	for (const Entry& e : *batch)
+	{
+		tinybvh::Ray shadowRay(e.origin, e.direction, e.distance);
+		if (!scene.IsOccluded(shadowRay))
+			results[e.target] += e.contribution;
+	}
+	entries.clear();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+class Scene;
+
+// Shadow ray of a direct light sample, contribution is only added when the ray is unoccluded
+struct ShadowSample
+{
+	float3 origin, direction;
+	float distance;
+	float3 contribution;
+	int light; // point light index (modulo POINTLIGHTS for light tree lights), POINTLIGHTS for the directional light, POINTLIGHTS + 1 for spot lights, EMITTERLIGHT for emissive triangles, AREALIGHT for area lights, SKYLIGHT for the skydome
+};
+
+constexpr int EMITTERLIGHT = POINTLIGHTS + 2;
+constexpr int AREALIGHT = POINTLIGHTS + 3;
+constexpr int SKYLIGHT = POINTLIGHTS + 4;
+// Most shadow rays one area light sample traces, the "samples" of an area light's json are capped to it
+constexpr int AREALIGHTSAMPLES = POINTLIGHTS;
+// Most shadow rays one hit records: the reservoir's and an area light's, then one to an emitter and one to the sky
+constexpr int HITSHADOWSAMPLES = AREALIGHTSAMPLES + 3;
+
+// Shadow rays recorded while shading and traced later in one go, so the any-hit traversals
+// do not interleave with the shading work. Every ray remembers which result it adds to.
+class ShadowBatch
+{
+public:
+	bool sorted = true; // trace grouped by light and direction octant
+	int target = 0; // result slot the next pushed rays contribute to
+
+	void Push(const ShadowSample& sample, const float3& weight);
+	// Traces every queued ray and adds the unoccluded contributions to results[target], then clears the batch
+	void Resolve(const Scene& scene, float3* results);
+	int Size() const { return static_cast<int>(entries.size()); }
+
+private:
+	struct Entry
+	{
+		float3 origin;
+		float distance;
+		float3 direction;
+		int target;
+		float3 contribution;
+		uint key;
+	};
+
+	std::vector<Entry> entries, sortedEntries;
+};
@@ -0,0 +1,231 @@
+#include "precomp.h"
+#include "SimdLights.h"
+
+// Every back end wraps its vector type in Vec, with the operations the kernels use, and then includes the
+// kernels. GCC and Clang only allow an instruction set's intrinsics in functions compiled for it, so each
+// back end is enabled for the functions it defines; MSVC allows every intrinsic anywhere.
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.1"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+namespace sse4
+{
+struct Vec
+{
+	static constexpr int width = 4;
+	__m128 v;
+	Vec() = default;
+	Vec(const __m128 a) : v(a) {}
+	explicit Vec(const float a) : v(_mm_set1_ps(a)) {}
+};
+typedef __m128 Mask;
+inline Vec operator+(const Vec a, const Vec b) { return _mm_add_ps(a.v, b.v); }
+inline Vec operator-(const Vec a, const Vec b) { return _mm_sub_ps(a.v, b.v); }
+inline Vec operator*(const Vec a, const Vec b) { return _mm_mul_ps(a.v, b.v); }
+inline Vec operator/(const Vec a, const Vec b) { return _mm_div_ps(a.v, b.v); }
+inline Vec Load(const float* p) { return _mm_loadu_ps(p); }
+inline void Store(float* p, const Vec a) { _mm_storeu_ps(p, a.v); }
+inline Vec Sqrt(const Vec a) { return _mm_sqrt_ps(a.v); }
+inline Vec Max(const Vec a, const Vec b) { return _mm_max_ps(a.v, b.v); }
+inline Mask Greater(const Vec a, const Vec b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Mask And(const Mask a, const Mask b) { return _mm_and_ps(a, b); }
+inline Vec Select(const Mask mask, const Vec a, const Vec b) { return _mm_blendv_ps(b.v, a.v, mask); }
+#include "SimdLightsKernel.h"
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+namespace avx2
+{
+struct Vec
+{
+	static constexpr int width = 8;
+	__m256 v;
+	Vec() = default;
+	Vec(const __m256 a) : v(a) {}
+	explicit Vec(const float a) : v(_mm256_set1_ps(a)) {}
+};
+typedef __m256 Mask;
+inline Vec operator+(const Vec a, const Vec b) { return _mm256_add_ps(a.v, b.v); }
+inline Vec operator-(const Vec a, const Vec b) { return _mm256_sub_ps(a.v, b.v); }
+inline Vec operator*(const Vec a, const Vec b) { return _mm256_mul_ps(a.v, b.v); }
+inline Vec operator/(const Vec a, const Vec b) { return _mm256_div_ps(a.v, b.v); }
+inline Vec Load(const float* p) { return _mm256_loadu_ps(p); }
+inline void Store(float* p, const Vec a) { _mm256_storeu_ps(p, a.v); }
+inline Vec Sqrt(const Vec a) { return _mm256_sqrt_ps(a.v); }
+inline Vec Max(const Vec a, const Vec b) { return _mm256_max_ps(a.v, b.v); }
+inline Mask Greater(const Vec a, const Vec b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline Mask And(const Mask a, const Mask b) { return _mm256_and_ps(a, b); }
+inline Vec Select(const Mask mask, const Vec a, const Vec b) { return _mm256_blendv_ps(b.v, a.v, mask); }
+#include "SimdLightsKernel.h"
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+namespace avx512
+{
+struct Vec
+{
+	static constexpr int width = 16;
+	__m512 v;
+	Vec() = default;
+	Vec(const __m512 a) : v(a) {}
+	explicit Vec(const float a) : v(_mm512_set1_ps(a)) {}
+};
+typedef __mmask16 Mask;
+inline Vec operator+(const Vec a, const Vec b) { return _mm512_add_ps(a.v, b.v); }
+inline Vec operator-(const Vec a, const Vec b) { return _mm512_sub_ps(a.v, b.v); }
+inline Vec operator*(const Vec a, const Vec b) { return _mm512_mul_ps(a.v, b.v); }
+inline Vec operator/(const Vec a, const Vec b) { return _mm512_div_ps(a.v, b.v); }
+inline Vec Load(const float* p) { return _mm512_loadu_ps(p); }
+inline void Store(float* p, const Vec a) { _mm512_storeu_ps(p, a.v); }
+inline Vec Sqrt(const Vec a) { return _mm512_sqrt_ps(a.v); }
+inline Vec Max(const Vec a, const Vec b) { return _mm512_max_ps(a.v, b.v); }
+inline Mask Greater(const Vec a, const Vec b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+inline Mask And(const Mask a, const Mask b) { return (Mask)(a & b); }
+inline Vec Select(const Mask mask, const Vec a, const Vec b) { return _mm512_mask_blend_ps(mask, b.v, a.v); }
+#include "SimdLightsKernel.h"
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+// The padding fits the widest back end, narrower ones simply take more steps
+static const int widestVector = 16;
+
+void LightResults::Resize(const int count)
+{
+	for (std::vector<float>* array : { &r, &g, &b, &x, &y, &z, &distance })
+		if ((int)array->size() < count) array->resize(count);
+}
+
+void SimdLights::Assign(const TreeLight* lights, const int lightCount)
+{
+	count = lightCount;
+	const int padded = (lightCount + widestVector - 1) / widestVector * widestVector;
+	for (std::vector<float>* array : { &x, &y, &z, &r, &g, &b, &dx, &dy, &dz, &cosCutoff }) array->assign(padded, 0.f);
+	for (int i = 0; i < lightCount; i++)
+	{
+		const TreeLight& light = lights[i];
+		x[i] = light.position.x, y[i] = light.position.y, z[i] = light.position.z;
+		r[i] = light.color.x, g[i] = light.color.y, b[i] = light.color.z;
+		dx[i] = light.direction.x, dy[i] = light.direction.y, dz[i] = light.direction.z;
+		cosCutoff[i] = light.cosCutoff > -1.f ? light.cosCutoff : -2.f; // below every cosine, a point light reaches every direction
+	}
+}
+
+SimdLights::Arrays SimdLights::Data() const
+{
+	return Arrays{ x.data(), y.data(), z.data(), r.data(), g.data(), b.data(), dx.data(), dy.data(), dz.data(), cosCutoff.data(), Padded() };
+}
+
+void SimdLights::Evaluate(const float3& I, const float3& N, LightResults& results) const
+{
+	results.Resize(Padded());
+	switch (Selected())
+	{
+	case SimdIsa::AVX512: avx512::EvaluateLights(Data(), I, N, results); break;
+	case SimdIsa::AVX2: avx2::EvaluateLights(Data(), I, N, results); break;
+	default: sse4::EvaluateLights(Data(), I, N, results); break;
+	}
+}
+
+float3 SimdLights::Sum(const float3& I, const float3& N) const
+{
+	switch (Selected())
+	{
+	case SimdIsa::AVX512: return avx512::SumLights(Data(), I, N);
+	case SimdIsa::AVX2: return avx2::SumLights(Data(), I, N);
+	default: return sse4::SumLights(Data(), I, N);
+	}
+}
+
+// Register state the OS saves on a context switch (XCR0), wide registers are only usable when it saves them
+static uint64_t SavedRegisterState()
+{
+	int info[4];
+	cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0) return 0; // no OSXSAVE, so no XGETBV either
+#ifdef _WIN32
+	return _xgetbv(0);
+#else
+	uint eax, edx;
+	__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
+bool SimdLights::Supported(const SimdIsa isa)
+{
+	static const CPUCaps caps; // fills the CPUCaps flags, whatever order the statics are initialized in
+	static const uint64_t saved = SavedRegisterState();
+	switch (isa)
+	{
+	case SimdIsa::AVX512: return caps.HW_AVX512F && (saved & 0xe6) == 0xe6; // SSE, AVX and the three AVX-512 states
+	case SimdIsa::AVX2: return caps.HW_AVX2 && caps.HW_FMA3 && (saved & 0x6) == 0x6;
+	default: return caps.HW_SSE41;
+	}
+}
+
+SimdIsa SimdLights::Detect()
+{
+	if (Supported(SimdIsa::AVX512)) return SimdIsa::AVX512;
+	if (Supported(SimdIsa::AVX2)) return SimdIsa::AVX2;
+	return SimdIsa::SSE4;
+}
+
+static SimdIsa& CurrentIsa()
+{
+	static SimdIsa isa = SimdLights::Detect();
+	return isa;
+}
+
+void SimdLights::Select(const SimdIsa isa)
+{
+	SimdIsa candidate = isa;
+	while (candidate != SimdIsa::SSE4 && !Supported(candidate)) candidate = static_cast<SimdIsa>(static_cast<int>(candidate) - 1);
+	CurrentIsa() = candidate;
+}
+
+SimdIsa SimdLights::Selected()
+{
+	return CurrentIsa();
+}
+
+const char* SimdLights::IsaName(const SimdIsa isa)
+{
+	switch (isa)
+	{
+	case SimdIsa::AVX512: return "avx512";
+	case SimdIsa::AVX2: return "avx2";
+	default: return "sse4";
+	}
+}
+
+int SimdLights::Width(const SimdIsa isa)
+{
+	return isa == SimdIsa::AVX512 ? 16 : isa == SimdIsa::AVX2 ? 8 : 4;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "LightTree.h"
+
+// Instruction sets the light kernels are compiled for, picked at runtime from what the CPU supports
+enum class SimdIsa
+{
+	SSE4, // 4 lanes
+	AVX2, // 8 lanes
+	AVX512, // 16 lanes
+};
+
+// Light of a run of lights arriving at one shading point, one float per light in every array
+struct LightResults
+{
+	std::vector<float> r, g, b; // incident light, 0 for lights that cannot reach the point
+	std::vector<float> x, y, z; // unit direction towards the light
+	std::vector<float> distance;
+
+	void Resize(const int count);
+};
+
+// Point and spot lights as structure of arrays, padded with black lights to a multiple of the widest
+// vector, so one kernel written against a vector type evaluates any number of lights at any width
+class SimdLights
+{
+public:
+	// The flat arrays the kernels read
+	struct Arrays
+	{
+		const float *x, *y, *z, *r, *g, *b, *dx, *dy, *dz, *cosCutoff;
+		int count; // a multiple of the widest vector
+	};
+
+	void Assign(const TreeLight* lights, const int count);
+	int Size() const { return count; }
+	int Padded() const { return (int)x.size(); }
+
+	// Every light's incident light at I through a surface with normal N, not counting occlusion, as LightTree::Incident
+	void Evaluate(const float3& I, const float3& N, LightResults& results) const;
+	float3 Sum(const float3& I, const float3& N) const; // Total incident light of all lights
+
+	// Runtime dispatch: the widest instruction set both the CPU and the OS support, unless Select narrowed it
+	static SimdIsa Detect();
+	static bool Supported(const SimdIsa isa);
+	static void Select(const SimdIsa isa); // Falls back to the widest supported set below isa
+	static SimdIsa Selected();
+	static const char* IsaName(const SimdIsa isa);
+	static int Width(const SimdIsa isa);
+
+private:
+	Arrays Data() const;
+
+	std::vector<float> x, y, z, r, g, b, dx, dy, dz, cosCutoff;
+	int count = 0;
+};
@@ -0,0 +1,55 @@
+// Light kernels written once against Vec and Mask. SimdLights.cpp includes this file inside the namespace of
+// every instruction set, with that set enabled for the functions defined here, so there is no include guard.
+
+// One vector of lights: direction towards them, their distance and the factor their color is scaled by
+static inline void IncidentLights(const SimdLights::Arrays& lights, const int i, const Vec I[3], const Vec N[3], Vec& lx, Vec& ly, Vec& lz, Vec& distance, Vec& scale)
+{
+	lx = Load(lights.x + i) - I[0];
+	ly = Load(lights.y + i) - I[1];
+	lz = Load(lights.z + i) - I[2];
+	const Vec distance2 = lx * lx + ly * ly + lz * lz;
+	distance = Sqrt(distance2);
+	const Vec inverse = Vec(1.f) / Max(distance, Vec(1e-20f));
+	lx = lx * inverse, ly = ly * inverse, lz = lz * inverse;
+
+	// Facing the surface, inside the spot light's cone and not at the shading point itself
+	const Vec cosa = N[0] * lx + N[1] * ly + N[2] * lz;
+	const Vec cone = Vec(0.f) - (Load(lights.dx + i) * lx + Load(lights.dy + i) * ly + Load(lights.dz + i) * lz);
+	const Mask lit = And(And(Greater(cosa, Vec(0.f)), Greater(cone, Load(lights.cosCutoff + i))), Greater(distance2, Vec(0.f)));
+	scale = Select(lit, cosa * inverse * inverse, Vec(0.f));
+}
+
+static void EvaluateLights(const SimdLights::Arrays& lights, const float3& I, const float3& N, LightResults& results)
+{
+	const Vec position[3] = { Vec(I.x), Vec(I.y), Vec(I.z) }, normal[3] = { Vec(N.x), Vec(N.y), Vec(N.z) };
+	for (int i = 0; i < lights.count; i += Vec::width)
+	{
+		Vec lx, ly, lz, distance, scale;
+		IncidentLights(lights, i, position, normal, lx, ly, lz, distance, scale);
+		Store(results.r.data() + i, Load(lights.r + i) * scale);
+		Store(results.g.data() + i, Load(lights.g + i) * scale);
+		Store(results.b.data() + i, Load(lights.b + i) * scale);
+		Store(results.x.data() + i, lx), Store(results.y.data() + i, ly), Store(results.z.data() + i, lz);
+		Store(results.distance.data() + i, distance);
+	}
+}
+
+static float3 SumLights(const SimdLights::Arrays& lights, const float3& I, const float3& N)
+{
+	const Vec position[3] = { Vec(I.x), Vec(I.y), Vec(I.z) }, normal[3] = { Vec(N.x), Vec(N.y), Vec(N.z) };
+	Vec sumR(0.f), sumG(0.f), sumB(0.f);
+	for (int i = 0; i < lights.count; i += Vec::width)
+	{
+		Vec lx, ly, lz, distance, scale;
+		IncidentLights(lights, i, position, normal, lx, ly, lz, distance, scale);
+		sumR = sumR + Load(lights.r + i) * scale;
+		sumG = sumG + Load(lights.g + i) * scale;
+		sumB = sumB + Load(lights.b + i) * scale;
+	}
+
+	float lanes[3][Vec::width];
+	Store(lanes[0], sumR), Store(lanes[1], sumG), Store(lanes[2], sumB);
+	float3 total(0.f);
+	for (int lane = 0; lane < Vec::width; lane++) total += float3(lanes[0][lane], lanes[1][lane], lanes[2][lane]);
+	return total;
+}
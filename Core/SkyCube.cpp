@@ -0,0 +1,149 @@
+#include "precomp.h"
+#include "SkyCube.h"
+#include "SimdLights.h"
+
+// Face f looks along axis f / 2, positive for even f. Its position (s, t) in [-1, 1] runs along the next two
+// axes, direction = major axis + s * next axis + t * the one after, so a face never needs a sign flip.
+
+void SkyCube::Build(const float* pixels, const int width, const int height, const int channels, const int faceSize)
+{
+	texels.clear(), size = stride = 0;
+	if (pixels == nullptr || width <= 0 || height <= 0) return;
+
+	size = faceSize > 0 ? faceSize : max(width / 4, 1);
+	stride = size + 2;
+	texels.assign((size_t)6 * stride * stride * 4, 0.f);
+	for (int face = 0; face < 6; face++)
+	{
+		const int axis = face / 2;
+		const float sign = face & 1 ? -1.f : 1.f;
+		for (int y = 0; y < stride; y++)
+			for (int x = 0; x < stride; x++)
+			{
+				// Border texels sit half a texel past the edge, their direction simply continues the face's plane
+				float d[3];
+				d[axis] = sign;
+				d[(axis + 1) % 3] = (x - 0.5f) / size * 2.f - 1.f;
+				d[(axis + 2) % 3] = (y - 0.5f) / size * 2.f - 1.f;
+				const float3 color = Equirectangular(pixels, width, height, channels, normalize(float3(d[0], d[1], d[2])));
+				float* texel = texels.data() + (((size_t)face * stride + y) * stride + x) * 4;
+				texel[0] = color.x, texel[1] = color.y, texel[2] = color.z;
+			}
+	}
+}
+
+float3 SkyCube::Lookup(const float3& D) const
+{
+	if (Empty()) return float3(0.f);
+
+	const float a[3] = { fabsf(D.x), fabsf(D.y), fabsf(D.z) }, d[3] = { D.x, D.y, D.z };
+	const int axis = a[0] >= a[1] && a[0] >= a[2] ? 0 : a[1] >= a[2] ? 1 : 2;
+	const int face = axis * 2 + (d[axis] < 0.f ? 1 : 0);
+	const float inverse = 1.f / max(a[axis], 1e-20f);
+
+	// Texel space of the padded face, in [0.5, size + 0.5] so both taps stay inside it
+	const float x = (d[(axis + 1) % 3] * inverse + 1.f) * 0.5f * size + 0.5f;
+	const float y = (d[(axis + 2) % 3] * inverse + 1.f) * 0.5f * size + 0.5f;
+	const int x0 = min((int)x, size), y0 = min((int)y, size);
+	const float fx = x - x0, fy = y - y0;
+
+	const float* t00 = texels.data() + (((size_t)face * stride + y0) * stride + x0) * 4;
+	const float* t01 = t00 + 4, * t10 = t00 + stride * 4, * t11 = t10 + 4;
+	const float3 top = float3(t00[0], t00[1], t00[2]) * (1.f - fx) + float3(t01[0], t01[1], t01[2]) * fx;
+	const float3 bottom = float3(t10[0], t10[1], t10[2]) * (1.f - fx) + float3(t11[0], t11[1], t11[2]) * fx;
+	return top * (1.f - fy) + bottom * fy;
+}
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+static void Lookup8Avx2(const float* texels, const int size, const int stride, const float* dx, const float* dy, const float* dz, float* r, float* g, float* b)
+{
+	const __m256 x = _mm256_loadu_ps(dx), y = _mm256_loadu_ps(dy), z = _mm256_loadu_ps(dz);
+	const __m256 signMask = _mm256_set1_ps(-0.f), zero = _mm256_setzero_ps();
+	const __m256 ax = _mm256_andnot_ps(signMask, x), ay = _mm256_andnot_ps(signMask, y), az = _mm256_andnot_ps(signMask, z);
+
+	// Face per lane: X where it dominates, then Y, else Z; the plane coordinates follow the axis order of Lookup
+	const __m256 isX = _mm256_and_ps(_mm256_cmp_ps(ax, ay, _CMP_GE_OQ), _mm256_cmp_ps(ax, az, _CMP_GE_OQ));
+	const __m256 isY = _mm256_andnot_ps(isX, _mm256_cmp_ps(ay, az, _CMP_GE_OQ));
+	const __m256 major = _mm256_blendv_ps(_mm256_blendv_ps(az, ay, isY), ax, isX);
+	const __m256 s = _mm256_blendv_ps(_mm256_blendv_ps(x, z, isY), y, isX);
+	const __m256 t = _mm256_blendv_ps(_mm256_blendv_ps(y, x, isY), z, isX);
+	const __m256 value = _mm256_blendv_ps(_mm256_blendv_ps(z, y, isY), x, isX);
+	const __m256i axis = _mm256_castps_si256(_mm256_blendv_ps(_mm256_blendv_ps(_mm256_castsi256_ps(_mm256_set1_epi32(2)), _mm256_castsi256_ps(_mm256_set1_epi32(1)), isY), zero, isX));
+	const __m256i negative = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(value, zero, _CMP_LT_OQ)), _mm256_set1_epi32(1));
+	const __m256i face = _mm256_add_epi32(_mm256_add_epi32(axis, axis), negative);
+
+	const __m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_max_ps(major, _mm256_set1_ps(1e-20f)));
+	const __m256 half = _mm256_set1_ps(0.5f * size), offset = _mm256_set1_ps(0.5f * size + 0.5f);
+	const __m256 px = _mm256_fmadd_ps(_mm256_mul_ps(s, inverse), half, offset), py = _mm256_fmadd_ps(_mm256_mul_ps(t, inverse), half, offset);
+	const __m256i last = _mm256_set1_epi32(size);
+	const __m256i x0 = _mm256_min_epi32(_mm256_cvttps_epi32(px), last), y0 = _mm256_min_epi32(_mm256_cvttps_epi32(py), last);
+	const __m256 fx = _mm256_sub_ps(px, _mm256_cvtepi32_ps(x0)), fy = _mm256_sub_ps(py, _mm256_cvtepi32_ps(y0));
+
+	// Float index of the top left tap, four floats per texel
+	const __m256i strideVector = _mm256_set1_epi32(stride);
+	const __m256i row = _mm256_add_epi32(_mm256_mullo_epi32(face, strideVector), y0);
+	const __m256i i00 = _mm256_slli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(row, strideVector), x0), 2);
+	const __m256i i01 = _mm256_add_epi32(i00, _mm256_set1_epi32(4));
+	const __m256i i10 = _mm256_add_epi32(i00, _mm256_set1_epi32(stride * 4)), i11 = _mm256_add_epi32(i10, _mm256_set1_epi32(4));
+
+	float* out[3] = { r, g, b };
+	for (int channel = 0; channel < 3; channel++)
+	{
+		const float* base = texels + channel;
+		const __m256 c00 = _mm256_i32gather_ps(base, i00, 4), c01 = _mm256_i32gather_ps(base, i01, 4);
+		const __m256 c10 = _mm256_i32gather_ps(base, i10, 4), c11 = _mm256_i32gather_ps(base, i11, 4);
+		const __m256 top = _mm256_fmadd_ps(_mm256_sub_ps(c01, c00), fx, c00), bottom = _mm256_fmadd_ps(_mm256_sub_ps(c11, c10), fx, c10);
+		_mm256_storeu_ps(out[channel], _mm256_fmadd_ps(_mm256_sub_ps(bottom, top), fy, top));
+	}
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+void SkyCube::Lookup8(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b) const
+{
+	static const bool avx2 = SimdLights::Supported(SimdIsa::AVX2);
+	if (avx2 && !Empty())
+	{
+		Lookup8Avx2(texels.data(), size, stride, dx, dy, dz, r, g, b);
+		return;
+	}
+	for (int i = 0; i < 8; i++)
+	{
+		const float3 color = Lookup(float3(dx[i], dy[i], dz[i]));
+		r[i] = color.x, g[i] = color.y, b[i] = color.z;
+	}
+}
+
+float3 SkyCube::Equirectangular(const float* pixels, const int width, const int height, const int channels, const float3& D)
+{
+	float u = 0.5f + (atan2f(D.z, D.x) / (2.0f * PI));
+	float v = acosf(clamp(D.y, -1.f, 1.f)) / PI;
+
+	float uTex = u * width;
+	float vTex = v * height;
+
+	uint u0 = static_cast<uint>(floor(uTex)) % width;
+	uint v0 = min(static_cast<uint>(floor(vTex)), (uint)height - 1);
+	uint u1 = (u0 + 1) % width;
+	uint v1 = min(v0 + 1, (uint)height - 1); // rows stop at the poles, only the longitude wraps
+
+	float du = uTex - floor(uTex);
+	float dv = vTex - floor(vTex);
+
+	const float* p00 = pixels + (u0 + v0 * width) * channels;
+	const float* p01 = pixels + (u1 + v0 * width) * channels;
+	const float* p10 = pixels + (u0 + v1 * width) * channels;
+	const float* p11 = pixels + (u1 + v1 * width) * channels;
+
+	float3 interpU0 = float3(p00[0], p00[1], p00[2]) + du * (float3(p01[0], p01[1], p01[2]) - float3(p00[0], p00[1], p00[2]));
+	float3 interpU1 = float3(p10[0], p10[1], p10[2]) + du * (float3(p11[0], p11[1], p11[2]) - float3(p10[0], p10[1], p10[2]));
+	return interpU0 + dv * (interpU1 - interpU0);
+}
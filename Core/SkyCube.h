@@ -0,0 +1,25 @@
+#pragma once
+
+// The skydome resampled to a cube map when it loads, so a miss finds its texel without a transcendental
+// function: the direction's largest component picks the face, the other two divided by it are the position
+// on the face. Every face has a border of one texel filled from the directions just beyond its edges, so the
+// bilinear filter never has to wrap or cross to a neighboring face.
+class SkyCube
+{
+public:
+	// Latitude-longitude RGB(A) floats; faceSize 0 matches the skydome's texel density at the equator
+	void Build(const float* pixels, const int width, const int height, const int channels, const int faceSize = 0);
+	bool Empty() const { return size == 0; }
+
+	float3 Lookup(const float3& D) const;
+	// Eight directions at once, as structure of arrays; AVX2 when the CPU supports it, Lookup otherwise
+	void Lookup8(const float* dx, const float* dy, const float* dz, float* r, float* g, float* b) const;
+
+private:
+	// Bilinear lookup in the latitude-longitude source, the way the skydome was sampled before the cube
+	static float3 Equirectangular(const float* pixels, const int width, const int height, const int channels, const float3& D);
+
+	std::vector<float> texels; // 6 faces of stride * stride texels, RGB plus one float of padding
+	int size = 0; // texels along a face's edge, without the border
+	int stride = 0;
+};
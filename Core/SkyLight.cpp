@@ -0,0 +1,89 @@
+#include "precomp.h"
+#include "SkyLight.h"
+
+void SkyLight::Build(const float* pixels, const int w, const int h, const int channels)
+{
+	width = w, height = h, total = 0.f;
+	marginal.assign(height + 1, 0.f);
+	conditional.assign((size_t)height * (width + 1), 0.f);
+	pdfs.assign((size_t)width * height, 0.f);
+	if (pixels == nullptr || width <= 0 || height <= 0) return;
+
+	// Luminance times sin(theta), the pixels near the poles cover less of the sphere
+	std::vector<float> rows(height, 0.f);
+	for (int y = 0; y < height; y++)
+	{
+		const float sinTheta = sinf(PI * (y + 0.5f) / height);
+		float* cdf = conditional.data() + (size_t)y * (width + 1);
+		for (int x = 0; x < width; x++)
+		{
+			const float* pixel = pixels + ((size_t)y * width + x) * channels;
+			const float weight = max(BRDF::getInstance()->luminance(float3(pixel[0], pixel[1], pixel[2])), 0.f) * sinTheta;
+			pdfs[(size_t)y * width + x] = weight;
+			cdf[x + 1] = cdf[x] + weight;
+		}
+		rows[y] = cdf[width];
+		for (int x = 1; x <= width; x++) cdf[x] = rows[y] > 0.f ? cdf[x] / rows[y] : (float)x / width;
+		marginal[y + 1] = marginal[y] + rows[y];
+	}
+
+	const float sum = marginal[height];
+	if (sum <= 0.f) return;
+	for (int y = 1; y <= height; y++) marginal[y] /= sum;
+	for (float& pdf : pdfs) pdf *= (float)width * height / sum;
+
+	// Every pixel spans 2pi/width by pi/height radians
+	total = sum * (2.f * PI / width) * (PI / height);
+}
+
+int SkyLight::Find(const float* cdf, const int count, const float u, float& offset)
+{
+	// Last entry not above u, intervals of zero width are never picked
+	const int index = clamp((int)(std::upper_bound(cdf, cdf + count + 1, u) - cdf) - 1, 0, count - 1);
+	const float width = cdf[index + 1] - cdf[index];
+	offset = width > 0.f ? min((u - cdf[index]) / width, 0.99999994f) : 0.5f;
+	return index;
+}
+
+bool SkyLight::Sample(const float u, const float v, SkySample& sample) const
+{
+	if (Empty()) return false;
+
+	float dy, dx;
+	const int y = Find(marginal.data(), height, v, dy);
+	const int x = Find(conditional.data() + (size_t)y * (width + 1), width, u, dx);
+	const float pdf = pdfs[(size_t)y * width + x];
+	if (pdf <= 0.f) return false;
+
+	const float texU = (x + dx) / width, texV = (y + dy) / height;
+	const float sinTheta = sinf(PI * texV);
+	if (sinTheta <= 0.f) return false;
+
+	// From the unit square to the sphere: dA = 2pi * pi * sin(theta)
+	sample.direction = Direction(texU, texV);
+	sample.pdf = pdf / (2.f * PI * PI * sinTheta);
+	return true;
+}
+
+float SkyLight::Pdf(const float3& direction) const
+{
+	if (Empty()) return 0.f;
+
+	const float2 uv = Coordinates(direction);
+	const int x = clamp((int)(uv.x * width), 0, width - 1), y = clamp((int)(uv.y * height), 0, height - 1);
+	const float sinTheta = sinf(PI * uv.y);
+	if (sinTheta <= 0.f) return 0.f;
+	return pdfs[(size_t)y * width + x] / (2.f * PI * PI * sinTheta);
+}
+
+float3 SkyLight::Direction(const float u, const float v)
+{
+	const float phi = (u - 0.5f) * 2.f * PI, theta = v * PI;
+	const float sinTheta = sinf(theta);
+	return float3(sinTheta * cosf(phi), cosf(theta), sinTheta * sinf(phi));
+}
+
+float2 SkyLight::Coordinates(const float3& direction)
+{
+	return float2(0.5f + atan2f(direction.z, direction.x) / (2.f * PI), acosf(clamp(direction.y, -1.f, 1.f)) / PI);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// Direction towards the skydome picked for next event estimation
+struct SkySample
+{
+	float3 direction;
+	float pdf; // per unit solid angle
+};
+
+// The HDR skydome as a light: its pixels form a piecewise constant 2D distribution, weighted by their luminance
+// times the solid angle they cover, built once when the skydome is loaded. A row is picked through the marginal
+// cdf and a pixel within it through that row's conditional cdf, so bright windows are sampled directly instead of
+// only being found by bounces that escape the scene.
+class SkyLight
+{
+public:
+	// Latitude-longitude RGB(A) floats, mapped to directions as Camera::SampleSkybox does
+	void Build(const float* pixels, const int width, const int height, const int channels);
+	bool Empty() const { return total <= 0.f; }
+	float Power() const { return total; } // Luminance integrated over the sphere
+
+	bool Sample(const float u, const float v, SkySample& sample) const;
+	float Pdf(const float3& direction) const; // Solid angle pdf with which Sample picks the direction
+
+	static float3 Direction(const float u, const float v); // From the skydome's texture coordinates
+	static float2 Coordinates(const float3& direction);
+
+private:
+	// Index of the interval of a normalized cdf that u falls in, offset receives where in it
+	static int Find(const float* cdf, const int count, const float u, float& offset);
+
+	std::vector<float> marginal; // height + 1 entries, the running sum of the rows' weights over the total
+	std::vector<float> conditional; // height rows of width + 1 entries, each row's running sum over its weight
+	std::vector<float> pdfs; // per pixel, over the unit square of texture coordinates
+	int width = 0, height = 0;
+	float total = 0.f;
+};
@@ -0,0 +1,187 @@
+#include "precomp.h"
+#include "TileScheduler.h"
+
+TileScheduler::~TileScheduler()
+{
+	Shutdown();
+}
+
+void TileScheduler::Render(const int width, const int height, const std::function<void(const Tile&)>& renderTile)
+{
+	EnsureWorkers();
+	if (width != builtWidth || height != builtHeight || tileSize != builtTileSize) BuildTiles(width, height);
+	Dispatch(tiles, renderTile);
+}
+
+void TileScheduler::ForEach(const int count, const int batchSize, const std::function<void(int, int)>& job)
+{
+	if (count <= 0) return;
+	EnsureWorkers();
+	if (count != builtCount || batchSize != builtBatchSize)
+	{
+		const int size = max(1, batchSize);
+		batches.clear();
+		for (int first = 0; first < count; first += size)
+			batches.push_back(Tile{ first, 0, min(first + size, count), 1 });
+		builtCount = count, builtBatchSize = batchSize;
+	}
+	Dispatch(batches, [&job](const Tile& batch) { job(batch.x0, batch.x1); });
+}
+
+void TileScheduler::ResetStats()
+{
+	for (WorkerStats& s : stats) s = WorkerStats{};
+	frameTime = 0.f;
+}
+
+void TileScheduler::EnsureWorkers()
+{
+	const int desiredWorkers = threadCount > 0 ? threadCount : max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	if (desiredWorkers != WorkerCount()) Start(desiredWorkers);
+}
+
+void TileScheduler::Dispatch(const std::vector<Tile>& work, const std::function<void(const Tile&)>& renderTile)
+{
+	// Hand every worker a contiguous run of the work list (the workers are all parked here)
+	const int count = WorkerCount();
+	const int tileCount = static_cast<int>(work.size());
+	for (int i = 0; i < count; i++)
+	{
+		queues[i].head = (i * tileCount) / count;
+		queues[i].tail = ((i + 1) * tileCount) / count;
+	}
+
+	frameTimer.reset();
+	{
+		std::lock_guard<std::mutex> lock(frameLock);
+		items = &work;
+		job = &renderTile;
+		running = count;
+		frameIndex++;
+	}
+	frameStart.notify_all();
+
+	std::unique_lock<std::mutex> lock(frameLock);
+	frameDone.wait(lock, [this] { return running == 0; });
+	job = nullptr, items = nullptr;
+
+	frameTime += frameTimer.elapsed() * 1000.f;
+	for (WorkerStats& s : stats) s.idle = max(0.f, frameTime - s.busy);
+}
+
+void TileScheduler::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(frameLock);
+		quit = true;
+	}
+	frameStart.notify_all();
+	for (std::thread& worker : workers) worker.join();
+	workers.clear();
+}
+
+void TileScheduler::Start(const int count)
+{
+	Shutdown();
+	quit = false;
+	queues.reset(new WorkerQueue[count]);
+	stats.assign(count, WorkerStats{});
+	for (int i = 0; i < count; i++)
+		workers.emplace_back(&TileScheduler::WorkerLoop, this, i, frameIndex);
+}
+
+void TileScheduler::BuildTiles(const int width, const int height)
+{
+	tileSize = max(4, tileSize);
+	const int size = tileSize;
+
+	tiles.clear();
+	for (int y = 0; y < height; y += size)
+		for (int x = 0; x < width; x += size)
+			tiles.push_back(Tile{ x, y, min(x + size, width), min(y + size, height) });
+
+	// Morton order keeps consecutive tiles close together on screen, and thus in the BVH and textures
+	std::sort(tiles.begin(), tiles.end(), [size](const Tile& a, const Tile& b)
+		{
+			return MortonCode(a.x0 / size, a.y0 / size) < MortonCode(b.x0 / size, b.y0 / size);
+		});
+
+	builtWidth = width, builtHeight = height, builtTileSize = size;
+}
+
+bool TileScheduler::NextTile(const int id, int& tileIndex, bool& stolen)
+{
+	// Own run first, front to back
+	{
+		WorkerQueue& own = queues[id];
+		std::lock_guard<std::mutex> lock(own.lock);
+		if (own.head < own.tail)
+		{
+			tileIndex = own.head++;
+			stolen = false;
+			return true;
+		}
+	}
+
+	// Steal from the back of the next worker that still has tiles left
+	const int count = WorkerCount();
+	for (int i = 1; i < count; i++)
+	{
+		WorkerQueue& victim = queues[(id + i) % count];
+		std::lock_guard<std::mutex> lock(victim.lock);
+		if (victim.head < victim.tail)
+		{
+			tileIndex = --victim.tail;
+			stolen = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TileScheduler::WorkerLoop(const int id, int seenFrame)
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(frameLock);
+			frameStart.wait(lock, [&] { return quit || frameIndex != seenFrame; });
+			if (quit) return;
+			seenFrame = frameIndex;
+		}
+
+		RunFrame(id);
+
+		std::lock_guard<std::mutex> lock(frameLock);
+		if (--running == 0) frameDone.notify_one();
+	}
+}
+
+void TileScheduler::RunFrame(const int id)
+{
+	WorkerStats& s = stats[id];
+	int tileIndex;
+	bool stolen;
+	while (NextTile(id, tileIndex, stolen))
+	{
+		Timer t;
+		(*job)((*items)[tileIndex]);
+		s.busy += t.elapsed() * 1000.f;
+		s.tiles++;
+		if (stolen) s.stolen++;
+	}
+}
+
+uint TileScheduler::MortonCode(const uint x, const uint y)
+{
+	auto spread = [](uint v)
+		{
+			v &= 0xffff;
+			v = (v | (v << 8)) & 0x00ff00ff;
+			v = (v | (v << 4)) & 0x0f0f0f0f;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+			return v;
+		};
+	return spread(x) | (spread(y) << 1);
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+// Screen-space tile, pixel bounds are [x0, x1) x [y0, y1)
+struct Tile
+{
+	int x0, y0, x1, y1;
+};
+
+// Per-worker statistics of the last frame
+struct WorkerStats
+{
+	float busy = 0.f; // ms spent rendering tiles
+	float idle = 0.f; // ms spent waiting for work or for the other workers to finish
+	int tiles = 0;
+	int stolen = 0; // tiles taken from another worker's queue
+};
+
+// Persistent thread pool that renders a frame as Morton-ordered tiles.
+// Every worker owns a contiguous run of tiles and takes from its front; a worker that runs dry
+// steals from the back of another worker's run, which keeps neighbouring tiles on one core.
+// ForEach reuses the same workers for 1D batches, e.g. the stages of the wavefront tracer.
+class TileScheduler
+{
+public:
+	TileScheduler() = default;
+	~TileScheduler();
+
+	TileScheduler(const TileScheduler&) = delete;
+	TileScheduler& operator=(const TileScheduler&) = delete;
+
+	int tileSize = 16;
+	int threadCount = 0; // 0: one worker per hardware thread
+
+	std::vector<WorkerStats> stats; // summed over every dispatch since the last ResetStats
+	float frameTime = 0.f; // ms, wall clock of the dispatches since the last ResetStats
+
+	void Render(const int width, const int height, const std::function<void(const Tile&)>& renderTile);
+	// Runs job(first, last) over [0, count) in batches of batchSize; a batch is passed as Tile{ first, 0, last, 1 }
+	void ForEach(const int count, const int batchSize, const std::function<void(int, int)>& job);
+	void ResetStats();
+	void Shutdown();
+
+	int WorkerCount() const { return static_cast<int>(workers.size()); }
+
+private:
+	struct WorkerQueue
+	{
+		std::mutex lock;
+		int head = 0, tail = 0; // remaining range in tiles[]
+	};
+
+	void EnsureWorkers();
+	void Dispatch(const std::vector<Tile>& work, const std::function<void(const Tile&)>& renderTile);
+	void Start(const int count);
+	void BuildTiles(const int width, const int height);
+	bool NextTile(const int id, int& tileIndex, bool& stolen);
+	void WorkerLoop(const int id, int seenFrame);
+	void RunFrame(const int id);
+
+	static uint MortonCode(const uint x, const uint y);
+
+	std::vector<Tile> tiles, batches;
+	const std::vector<Tile>* items = nullptr; // work list of the running dispatch
+	std::unique_ptr<WorkerQueue[]> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex frameLock;
+	std::condition_variable frameStart, frameDone;
+	const std::function<void(const Tile&)>* job = nullptr;
+	int frameIndex = 0, running = 0;
+	bool quit = false;
+	Timer frameTimer;
+
+	int builtWidth = 0, builtHeight = 0, builtTileSize = 0;
+	int builtCount = -1, builtBatchSize = 0;
+};
@@ -1,4 +1,6 @@
 #include "precomp.h"
+
+#ifndef HEADLESS
 #include "UserInterface.h"
 
 UserInterface::UserInterface()
@@ -26,7 +28,7 @@ void UserInterface::UI()
 	ImGui::Dummy(ImVec2(0.0f, 5.0f));
 	static Renderer::RENDER_STATES& renderingMode = Renderer::getInstance()->renderingMode;
 
-	const char* renderStateNames[] = { "Combined", "Base Color", "Geometry Normal", "Shading Normal", "Metal", "Roughness", "Emissive" };
+	const char* renderStateNames[] = { "Combined", "Base Color", "Geometry Normal", "Shading Normal", "Metal", "Roughness", "Emissive", "Sample Heatmap" };
 
 	int currentMode = static_cast<int>(renderingMode);
 
@@ -89,18 +91,219 @@ void UserInterface::Performance()
 	ImGui::Text("%.1f fps", Renderer::getInstance()->fps); ImGui::SameLine();
 	ImGui::Text("%.1f Mrays/s", Renderer::getInstance()->rps / 1000);
 
+	if (ImGui::CollapsingHeader("Threads"))
+	{
+		const TileScheduler& scheduler = Renderer::getInstance()->scheduler;
+		for (int i = 0; i < static_cast<int>(scheduler.stats.size()); i++)
+		{
+			const WorkerStats& stats = scheduler.stats[i];
+			ImGui::Text("#%2i busy %5.2f ms idle %5.2f ms tiles %4i stolen %3i", i, stats.busy, stats.idle, stats.tiles, stats.stolen);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Frame Governor"))
+	{
+		Renderer* renderer = Renderer::getInstance();
+		FrameGovernor& governor = renderer->governor;
+		ImGui::Checkbox("Hold Frame Time", &governor.enabled); ImGui::SameLine();
+		ImGui::PushItemWidth(50.0f);
+		ImGui::DragFloat("ms##target", &governor.targetTime, 0.1f, 1.f, 200.f, "%.1f");
+		ImGui::PopItemWidth();
+		ImGui::Checkbox("Lower Bounces", &governor.adjustBounces); ImGui::SameLine();
+		ImGui::Checkbox("Lower AA", &governor.adjustAA);
+		ImGui::Text("trace %5.2f ms, scale %.2f (%ix%i)", renderer->scheduler.frameTime, renderer->renderScale, renderer->renderWidth, renderer->renderHeight);
+		ImGui::Text("bounces %i, AA %s", renderer->bounces, renderer->AA ? "on" : "off");
+		ImGui::Text("last: %s", governor.decision);
+		if (!governor.enabled)
+		{
+			ImGui::PushItemWidth(100.0f);
+			ImGui::SliderFloat("Render Scale", &renderer->renderScale, governor.minScale, governor.maxScale, "%.2f");
+			ImGui::PopItemWidth();
+		}
+	}
+
+	if (Renderer::getInstance()->WAVEFRONT && ImGui::CollapsingHeader("Wavefront Stages"))
+	{
+		const float* stageTime = Renderer::getInstance()->wavefront.stageTime;
+		ImGui::Text("generate %5.2f ms extend %5.2f ms", stageTime[0], stageTime[1]);
+		ImGui::Text("shade %5.2f ms connect %5.2f ms", stageTime[2], stageTime[3]);
+	}
+
+	if (Renderer::getInstance()->Denoising())
+		ImGui::Text("denoise %5.2f ms (%i iterations)", Renderer::getInstance()->denoiser.filterTime, Renderer::getInstance()->denoiser.iterations);
+	ImGui::Text("post-process %5.2f ms", Renderer::getInstance()->postProcess.time);
+
 	ImGui::Dummy(ImVec2(0.0f, 5.0f));
 }
 
 void UserInterface::Rendering()
 {
+	// Resolution of the screen and every per-pixel buffer, the window keeps its size
+	static const int2 resolutions[] = { int2(480, 270), int2(1280, 720), int2(1920, 1080), int2(2560, 1440), int2(3840, 2160), int2(7680, 4320) };
+	Renderer* renderer = Renderer::getInstance();
+	char current[32];
+	sprintf(current, "%ix%i", renderer->screenWidth, renderer->screenHeight);
+	if (ImGui::BeginCombo("Resolution", current))
+	{
+		for (const int2& resolution : resolutions)
+		{
+			char label[32];
+			sprintf(label, "%ix%i", resolution.x, resolution.y);
+			const bool selected = resolution.x == renderer->screenWidth && resolution.y == renderer->screenHeight;
+			if (ImGui::Selectable(label, selected) && !selected) renderer->SetResolution(resolution.x, resolution.y);
+		}
+		ImGui::EndCombo();
+	}
+
+	// Storage of the accumulated frames, the packed layouts trade precision for bandwidth
+	const AccumulatorFormat formats[] = { AccumulatorFormat::FLOAT4, AccumulatorFormat::FLOAT3, AccumulatorFormat::HALF, AccumulatorFormat::RGB9E5 };
+	if (ImGui::BeginCombo("Accumulator", Accumulator::FormatName(renderer->accumulatorFormat)))
+	{
+		for (const AccumulatorFormat format : formats)
+		{
+			const bool selected = format == renderer->accumulatorFormat;
+			if (ImGui::Selectable(Accumulator::FormatName(format), selected) && !selected) renderer->SetAccumulatorFormat(format);
+		}
+		ImGui::EndCombo();
+	}
+	ImGui::SameLine();
+	ImGui::Text("%i B/px", renderer->accumulator.BytesPerPixel());
+
+	// Sequence the random decisions of every path are drawn from, a switch starts accumulating anew
+	const SamplerType samplerTypes[] = { SamplerType::RANDOM, SamplerType::SOBOL };
+	if (ImGui::BeginCombo("Sampler", Sampler::TypeName(renderer->sampler.type)))
+	{
+		for (const SamplerType type : samplerTypes)
+		{
+			const bool selected = type == renderer->sampler.type;
+			if (ImGui::Selectable(Sampler::TypeName(type), selected) && !selected)
+			{
+				renderer->sampler.type = type;
+				renderer->ResetAccumulation();
+			}
+		}
+		ImGui::EndCombo();
+	}
+
 	ImGui::Text("Secondary Bounces: "); ImGui::SameLine();
 	float sliderWidth = 50.0f;
 	ImGui::PushItemWidth(sliderWidth);
 	ImGui::DragInt("##", &Renderer::getInstance()->bounces, 1, 0, 10);
 	ImGui::PopItemWidth();
 
+	ImGui::Checkbox("Russian Roulette", &Renderer::getInstance()->RUSSIANROULETTE);
+	if (Renderer::getInstance()->RUSSIANROULETTE)
+	{
+		ImGui::SameLine();
+		ImGui::Text("after: "); ImGui::SameLine();
+		ImGui::PushItemWidth(sliderWidth);
+		ImGui::DragInt("##roulettedepth", &Renderer::getInstance()->rouletteDepth, 1, 1, 10);
+		ImGui::PopItemWidth();
+	}
+
+	ImGui::Text("Tile Size: "); ImGui::SameLine();
+	ImGui::PushItemWidth(sliderWidth);
+	ImGui::DragInt("##tilesize", &Renderer::getInstance()->scheduler.tileSize, 1, 4, 64);
+	ImGui::PopItemWidth();
+
+	ImGui::Text("Threads (0 = all): "); ImGui::SameLine();
+	ImGui::PushItemWidth(sliderWidth);
+	ImGui::DragInt("##threads", &Renderer::getInstance()->scheduler.threadCount, 1, 0, 256);
+	ImGui::PopItemWidth();
+
+	ImGui::Checkbox("Primary Ray Packets", &Renderer::getInstance()->PACKETS);
+
+	ImGui::Checkbox("Reproject On Camera Move", &Renderer::getInstance()->REPROJECT);
+
+	ImGui::Checkbox("Adaptive Sampling", &Renderer::getInstance()->ADAPTIVE);
+	if (Renderer::getInstance()->ADAPTIVE)
+	{
+		ImGui::Text("Noise Threshold: "); ImGui::SameLine();
+		ImGui::PushItemWidth(sliderWidth);
+		ImGui::DragFloat("##adaptivethreshold", &Renderer::getInstance()->adaptiveThreshold, 0.001f, 0.001f, 0.5f, "%.3f");
+		ImGui::PopItemWidth();
+
+		ImGui::Text("Max Sample Scale: "); ImGui::SameLine();
+		ImGui::PushItemWidth(sliderWidth);
+		ImGui::DragInt("##adaptivescale", &Renderer::getInstance()->adaptiveMaxScale, 1, 1, 16);
+		ImGui::PopItemWidth();
+	}
+
+	ImGui::Checkbox("Deferred Shadow Rays", &Renderer::getInstance()->DEFERSHADOWS);
+	if (Renderer::getInstance()->DEFERSHADOWS)
+	{
+		ImGui::SameLine();
+		ImGui::Checkbox("Sorted", &Renderer::getInstance()->SORTSHADOWS);
+	}
+
+	ImGui::Checkbox("Wavefront Tracing", &Renderer::getInstance()->WAVEFRONT);
+
+	ImGui::Checkbox("Denoise", &Renderer::getInstance()->DENOISE);
+	if (Renderer::getInstance()->DENOISE)
+	{
+		Denoiser& denoiser = Renderer::getInstance()->denoiser;
+		ImGui::SameLine();
+		ImGui::Text("iterations: "); ImGui::SameLine();
+		ImGui::PushItemWidth(sliderWidth);
+		ImGui::DragInt("##denoiseiterations", &denoiser.iterations, 1, 0, 6);
+		ImGui::PopItemWidth();
+
+		ImGui::PushItemWidth(sliderWidth * 2);
+		ImGui::DragFloat("Color Sigma", &denoiser.colorSigma, 0.01f, 0.01f, 10.f, "%.2f");
+		ImGui::DragFloat("Normal Sigma", &denoiser.normalSigma, 0.01f, 0.01f, 2.f, "%.2f");
+		ImGui::DragFloat("Albedo Sigma", &denoiser.albedoSigma, 0.01f, 0.01f, 2.f, "%.2f");
+		ImGui::DragFloat("Depth Sigma", &denoiser.depthSigma, 0.005f, 0.005f, 1.f, "%.3f");
+		ImGui::PopItemWidth();
+	}
+
 	ImGui::Checkbox("Stochastic Lighting", &Renderer::getInstance()->isStochastic);
+	if (Renderer::getInstance()->isStochastic)
+	{
+		ImGui::SameLine();
+		ImGui::Checkbox("Light Tree", &Renderer::getInstance()->LIGHTTREE);
+		if (Renderer::getInstance()->LIGHTTREE)
+		{
+			ImGui::SameLine();
+			ImGui::Text("%i lights, %i nodes", Renderer::getInstance()->lightTree.Size(), Renderer::getInstance()->lightTree.Nodes());
+		}
+
+		// Share of the light samples every type gets, in proportion to its power
+		const char* typeNames[] = { "Point", "Directional", "Spot", "Tree", "Area" };
+		const Renderer* renderer = Renderer::getInstance();
+		for (int i = 0; i < (int)renderer->lightTypes.size() && i < renderer->lightSelection.Size(); i++)
+		{
+			if (i > 0) ImGui::SameLine();
+			ImGui::Text("%s %.0f%%", typeNames[static_cast<int>(renderer->lightTypes[i])], 100.f * renderer->lightSelection.Pmf(i));
+		}
+
+		// Primary hits resample their light from fresh candidates and the reservoirs of last frame
+		ImGui::Checkbox("ReSTIR Direct Light", &Renderer::getInstance()->RESTIR);
+		if (Renderer::getInstance()->RESTIR)
+		{
+			ImGui::PushItemWidth(100);
+			ImGui::SliderInt("Candidates", &Renderer::getInstance()->restirCandidates, 1, 32);
+			ImGui::SameLine();
+			ImGui::SliderInt("Neighbors", &Renderer::getInstance()->restirNeighbors, 0, 8);
+			ImGui::SameLine();
+			ImGui::SliderInt("Radius", &Renderer::getInstance()->restirRadius, 1, 64);
+			ImGui::PopItemWidth();
+		}
+	}
+
+	// Instruction set of the light kernels, sets the CPU or OS does not support fall back to a narrower one
+	const char* isaNames[] = { "SSE4", "AVX2", "AVX-512" };
+	int currentIsa = static_cast<int>(SimdLights::Selected());
+	if (ImGui::Combo("Light Kernels", &currentIsa, isaNames, IM_ARRAYSIZE(isaNames)))
+		SimdLights::Select(static_cast<SimdIsa>(currentIsa));
+
+	// Emissive surfaces as lights, weighted against the bounces that hit them
+	const char* misNames[] = { "Off", "Balance", "Power" };
+	int currentHeuristic = static_cast<int>(Renderer::getInstance()->misHeuristic);
+	if (ImGui::Combo("Emitter MIS", &currentHeuristic, misNames, IM_ARRAYSIZE(misNames)))
+	{
+		Renderer::getInstance()->misHeuristic = static_cast<Renderer::MIS_HEURISTIC>(currentHeuristic);
+		Renderer::getInstance()->ResetAccumulation();
+	}
 
 	ImGui::Checkbox("Anti Aliasing", &Renderer::getInstance()->AA);
 
@@ -110,6 +313,12 @@ void UserInterface::Rendering()
 
 	ImGui::Checkbox("Enable Normal Mapping", &Renderer::getInstance()->NORMALMAPPED);
 
+	ImGui::Checkbox("Texture LOD", &Renderer::getInstance()->TEXTURELOD);
+
+	size_t textureBytes, uncompressedBytes;
+	Renderer::getInstance()->scene.TextureMemory(textureBytes, uncompressedBytes);
+	ImGui::Text("Textures: %.1f MB (%.1f MB as RGBA8)", textureBytes / 1048576.0, uncompressedBytes / 1048576.0);
+
 	ImGui::Checkbox("Skybox", &Renderer::getInstance()->SKYBOX);
 
 	ImGui::Checkbox("Enable Bullet Colliders", &Renderer::getInstance()->COLLIDERS);
@@ -162,9 +371,9 @@ void UserInterface::Debug()
 	uint pixel = 0xFF00FF; // Default magenta
 	int red = -1, green = -1, blue = -1;
 
-	if (px >= 0 && px < SCRWIDTH && py >= 0 && py < SCRHEIGHT)
+	if (px >= 0 && px < Renderer::getInstance()->screenWidth && py >= 0 && py < Renderer::getInstance()->screenHeight)
 	{
-		pixel = Renderer::getInstance()->screen->pixels[px + py * SCRWIDTH];
+		pixel = Renderer::getInstance()->screen->pixels[px + py * Renderer::getInstance()->screenWidth];
 		red = (pixel & 0xFF0000) >> 16;
 		green = (pixel & 0x00FF00) >> 8;
 		blue = pixel & 0x0000FF;
@@ -193,9 +402,9 @@ void UserInterface::Debug()
 			uint pixel = 0xFF00FF;
 			int red = -1, green = -1, blue = -1;
 
-			if (px >= 0 && px < SCRWIDTH && py >= 0 && py < SCRHEIGHT)
+			if (px >= 0 && px < Renderer::getInstance()->screenWidth && py >= 0 && py < Renderer::getInstance()->screenHeight)
 			{
-				pixel = Renderer::getInstance()->screen->pixels[px + py * SCRWIDTH];
+				pixel = Renderer::getInstance()->screen->pixels[px + py * Renderer::getInstance()->screenWidth];
 				red = (pixel & 0xFF0000) >> 16;
 				green = (pixel & 0x00FF00) >> 8;
 				blue = pixel & 0x0000FF;
@@ -415,6 +624,53 @@ void UserInterface::LightsHierarchy()
 			ImGui::TreePop();
 		}
 	}
+
+	// Hierarchy for area lights
+	for (size_t i = 0; i < Renderer::getInstance()->scene.areaLights.size(); ++i)
+	{
+		AreaLight* light = Renderer::getInstance()->scene.areaLights[i];
+		if (ImGui::TreeNode(("Area Light " + std::to_string(i + 1)).c_str()))
+		{
+			ImGui::Text("P "); ImGui::SameLine();
+			if (ImGui::DragFloat3("##1", &light->transform->position.x, 0.1f)) light->Update();
+			ImGui::Dummy(ImVec2(0.0f, 3.0f));
+			ImGui::Text("C "); ImGui::SameLine();
+			if (ImGui::DragFloat3("##2", &light->transform->color.x)) light->Update();
+			ImGui::Dummy(ImVec2(0.0f, 5.0f));
+			ImGui::Text("R "); ImGui::SameLine();
+			if (ImGui::DragFloat3("##3", &light->transform->rotation.x, 0.1f)) light->Update();
+			ImGui::Dummy(ImVec2(0.0f, 3.0f));
+
+			// Shape, size and the shadow rays spread over it
+			const char* shapeNames[] = { "Rectangle", "Disk" };
+			int currentShape = static_cast<int>(light->shape);
+			ImGui::PushItemWidth(100);
+			if (ImGui::Combo("##4", &currentShape, shapeNames, IM_ARRAYSIZE(shapeNames)))
+			{
+				light->shape = static_cast<AreaLight::SHAPES>(currentShape);
+				light->Update();
+			}
+			ImGui::SameLine();
+			if (ImGui::SliderInt("Samples", &light->samples, 1, AREALIGHTSAMPLES)) light->Update();
+			ImGui::PopItemWidth();
+			ImGui::Text("S "); ImGui::SameLine();
+			if (ImGui::DragFloat2("##5", &light->size.x, 0.01f, 0.001f, 10.f)) light->Update();
+			ImGui::Dummy(ImVec2(0.0f, 3.0f));
+			if (ImGui::Button("Delete"))
+			{
+				light->DeleteData();
+				Renderer::getInstance()->scene.areaLights.erase(Renderer::getInstance()->scene.areaLights.begin() + i);
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Reset"))
+			{
+				light->Reset();
+				light->Update();
+			}
+
+			ImGui::TreePop();
+		}
+	}
 }
 
 void UserInterface::PhysicsObjectsHierarchy()
@@ -488,4 +744,6 @@ void UserInterface::Style()
 	ImGui::PushStyleColor(ImGuiCol_TabActive, IM_COL32(70, 70, 70, 255));      // Dark gray for active tab
 	ImGui::PushStyleColor(ImGuiCol_TabUnfocused, IM_COL32(30, 30, 30, 255));  // Even darker when unfocused
 	ImGui::PushStyleColor(ImGuiCol_TabUnfocusedActive, IM_COL32(50, 50, 50, 255));
-}
\ No newline at end of file
+}
+
+#endif // HEADLESS
@@ -0,0 +1,264 @@
+#include "precomp.h"
+#include "Wavefront.h"
+
+void PathQueue::Resize(const int capacity)
+{
+	for (std::vector<float>* a : { &ox, &oy, &oz, &dx, &dy, &dz, &tr, &tg, &tb, &pdf, &coneWidth, &coneSpread, &t, &u, &v }) a->resize(capacity);
+	path.resize(capacity), inst.resize(capacity), prim.resize(capacity);
+	shadowStart.resize(capacity), shadowCount.resize(capacity);
+	count = 0;
+}
+
+void ShadowQueue::Resize(const int capacity)
+{
+	for (std::vector<float>* a : { &ox, &oy, &oz, &dx, &dy, &dz, &dist, &cr, &cg, &cb }) a->resize(capacity);
+	count = 0;
+}
+
+void Wavefront::Render(Tmpl8::Renderer& renderer)
+{
+	TileScheduler& scheduler = renderer.scheduler;
+	const int pixels = renderer.renderWidth * renderer.renderHeight;
+	samples = renderer.AA ? max(1, renderer.spp) : 1;
+	const int paths = pixels * samples;
+
+	if ((int)radiance.size() != paths)
+	{
+		queues[0].Resize(paths), queues[1].Resize(paths);
+		shadows.Resize(paths * HITSHADOWSAMPLES); // Every path records at most one hit's shadow rays per bounce
+		radiance.resize(paths);
+		primaryDistance.resize(pixels);
+	}
+	for (int i = 0; i < 4; i++) stageTime[i] = 0.f;
+
+	Timer stage;
+	current = 0;
+	queues[current].count = 0;
+	scheduler.ForEach(paths, batchSize, [&](int first, int last) { Generate(renderer, first, last); });
+	queues[current].count = paths;
+	stageTime[0] += stage.elapsed() * 1000.f;
+
+	for (int depth = 0; depth < renderer.bounces; depth++)
+	{
+		const int live = queues[current].count;
+		if (live == 0) break;
+
+		stage.reset();
+		scheduler.ForEach(live, batchSize, [&](int first, int last) { Extend(renderer, first, last); });
+		stageTime[1] += stage.elapsed() * 1000.f;
+
+		stage.reset();
+		queues[current ^ 1].count = 0;
+		shadows.count = 0;
+		scheduler.ForEach(live, batchSize, [&](int first, int last) { Shade(renderer, depth, first, last); });
+		stageTime[2] += stage.elapsed() * 1000.f;
+
+		stage.reset();
+		if (shadows.count > 0)
+			scheduler.ForEach(live, batchSize, [&](int first, int last) { Connect(renderer, first, last); });
+		stageTime[3] += stage.elapsed() * 1000.f;
+
+		current ^= 1;
+	}
+
+	// Average the samples of every pixel and run them through the regular accumulation and post-processing
+	scheduler.Render(renderer.renderWidth, renderer.renderHeight, [&](const Tile& tile) { Resolve(renderer, tile); });
+}
+
+void Wavefront::Generate(Tmpl8::Renderer& renderer, const int first, const int last)
+{
+	PathQueue& q = queues[current];
+	for (int i = first; i < last; i++)
+	{
+		// First sample through the pixel corner (its hit distance drives accumulation), the rest jittered
+		const int pixel = i / samples, s = i % samples;
+		const int x = renderer.ScreenX(pixel % renderer.renderWidth), y = renderer.ScreenY(pixel / renderer.renderWidth);
+		const float footprintX = renderer.screenWidth / (float)renderer.renderWidth, footprintY = renderer.screenHeight / (float)renderer.renderHeight;
+		const int screenPixel = x + y * renderer.screenWidth;
+		renderer.BeginSample(screenPixel, renderer.SampleIndex(screenPixel, s));
+		const float2 jitter = s == 0 ? float2(0.f) : renderer.Jitter();
+		tinybvh::Ray ray = renderer.camera.GetPrimaryRay(x + jitter.x * footprintX, y + jitter.y * footprintY);
+
+		q.ox[i] = ray.O.x, q.oy[i] = ray.O.y, q.oz[i] = ray.O.z;
+		q.dx[i] = ray.D.x, q.dy[i] = ray.D.y, q.dz[i] = ray.D.z;
+		q.tr[i] = q.tg[i] = q.tb[i] = 1.f;
+		q.pdf[i] = 0.f;
+		q.coneWidth[i] = 0.f, q.coneSpread[i] = renderer.pixelSpread;
+		q.path[i] = i;
+		radiance[i] = float3{ 0.f };
+	}
+}
+
+void Wavefront::Extend(Tmpl8::Renderer& renderer, const int first, const int last)
+{
+	PathQueue& q = queues[current];
+	const tinybvh::BVH& tlas = renderer.scene.tlas;
+	for (int i = first; i < last; i++)
+	{
+		tinybvh::Ray ray(float3{ q.ox[i], q.oy[i], q.oz[i] }, float3{ q.dx[i], q.dy[i], q.dz[i] });
+		tlas.IntersectTLAS(ray);
+		q.t[i] = ray.hit.t, q.u[i] = ray.hit.u, q.v[i] = ray.hit.v;
+		q.inst[i] = ray.hit.inst, q.prim[i] = ray.hit.prim;
+	}
+}
+
+void Wavefront::Shade(Tmpl8::Renderer& renderer, const int depth, const int first, const int last)
+{
+	PathQueue& q = queues[current];
+	PathQueue& next = queues[current ^ 1];
+	const bool lastBounce = depth == renderer.bounces - 1;
+
+	// Stage the batch's output locally so the shared queues are reserved with one atomic per batch
+	std::vector<ShadowSample> localShadows;
+	std::vector<std::pair<int, tinybvh::Ray>> localBounces;
+	std::vector<float3> localThroughput;
+	std::vector<float> localPdf;
+	std::vector<float2> localCones; // width and spread
+	std::vector<int> localMisses; // looked up in the skydome eight at a time once the batch is shaded
+	localShadows.reserve((last - first) * HITSHADOWSAMPLES);
+
+	for (int i = first; i < last; i++)
+	{
+		const int path = q.path[i];
+		const bool primary = depth == 0 && path % samples == 0; // first sample of its pixel
+		const int pixel = path / samples;
+		const int screenPixel = renderer.ScreenX(pixel % renderer.renderWidth) + renderer.ScreenY(pixel / renderer.renderWidth) * renderer.screenWidth;
+		renderer.BeginSample(screenPixel, renderer.SampleIndex(screenPixel, path % samples), depth);
+		if (primary) primaryDistance[path / samples] = q.t[i];
+		q.shadowStart[i] = (int)localShadows.size(), q.shadowCount[i] = 0;
+
+		tinybvh::Ray ray(float3{ q.ox[i], q.oy[i], q.oz[i] }, float3{ q.dx[i], q.dy[i], q.dz[i] }, q.t[i]);
+		ray.hit.u = q.u[i], ray.hit.v = q.v[i], ray.hit.inst = q.inst[i], ray.hit.prim = q.prim[i];
+		const float3 throughput{ q.tr[i], q.tg[i], q.tb[i] };
+
+		if (ray.hit.t >= BVH_FAR)
+		{
+			if (primary) renderer.StoreFeatures(path / samples, DenoiseFeatures{});
+			if (renderer.SKYBOX) localMisses.push_back(i);
+			continue;
+		}
+
+		float3 I = ray.IntersectionPoint();
+		float3 V = -ray.D;
+		float3 geometryNormal = renderer.scene.GetGeometryNormal(ray);
+		const float coneWidth = q.coneWidth[i] + q.coneSpread[i] * ray.hit.t;
+		const float lod = renderer.TEXTURELOD ? renderer.scene.TextureLOD(ray, coneWidth) : 0.f;
+		float3 shadingNormal = renderer.scene.GetShadingNormal(ray, lod);
+		MaterialProperties hitMaterial = renderer.scene.GetMaterialBRDF(ray, lod);
+		if (primary) renderer.StoreFeatures(path / samples, DenoiseFeatures{ shadingNormal, hitMaterial.baseColor, ray.hit.t });
+
+		float3 debugColor;
+		if (renderer.DebugView(hitMaterial, geometryNormal, shadingNormal, debugColor))
+		{
+			radiance[path] += throughput * debugColor;
+			continue;
+		}
+
+		// Like Trace, a dielectric that continues only carries what it reflects and refracts
+		const bool dielectric = hitMaterial.transmissivness == 1;
+		if (!dielectric || lastBounce)
+		{
+			if (hitMaterial.emissive.x > 0.f || hitMaterial.emissive.y > 0.f || hitMaterial.emissive.z > 0.f)
+				radiance[path] += throughput * hitMaterial.emissive * renderer.EmissionWeight(ray, geometryNormal, q.pdf[i]);
+
+			ShadowSample samples[HITSHADOWSAMPLES];
+			int shadowCount = renderer.SampleLights(I, shadingNormal, V, hitMaterial, depth, ray.hit.t, samples);
+			if (renderer.SampleEmitter(I, shadingNormal, V, hitMaterial, lastBounce, samples[shadowCount])) shadowCount++;
+			if (renderer.SampleSky(I, shadingNormal, V, hitMaterial, lastBounce, samples[shadowCount])) shadowCount++;
+			for (int s = 0; s < shadowCount; s++)
+			{
+				samples[s].contribution *= throughput;
+				localShadows.push_back(samples[s]);
+			}
+			q.shadowCount[i] = shadowCount;
+		}
+
+		if (lastBounce) continue;
+
+		tinybvh::Ray bounceRay;
+		float3 bounceWeight;
+		float bouncePdf;
+		if (!renderer.SampleBounce(ray.D, I, shadingNormal, geometryNormal, hitMaterial, bounceRay, bounceWeight, bouncePdf)) continue;
+		float3 nextThroughput = throughput * bounceWeight;
+		if (!renderer.RussianRoulette(depth, nextThroughput)) continue;
+		localBounces.emplace_back(path, bounceRay);
+		localThroughput.push_back(nextThroughput);
+		localPdf.push_back(bouncePdf);
+		localCones.push_back(float2(coneWidth, renderer.ConeSpread(q.coneSpread[i], bouncePdf)));
+	}
+
+	// Sky seen by the batch's misses, eight directions per lookup; a partial group repeats its last miss
+	for (size_t m = 0; m < localMisses.size(); m += 8)
+	{
+		const int count = min(8, (int)(localMisses.size() - m));
+		float dx[8], dy[8], dz[8], r[8], g[8], b[8];
+		for (int k = 0; k < 8; k++)
+		{
+			const int i = localMisses[m + min(k, count - 1)];
+			dx[k] = q.dx[i], dy[k] = q.dy[i], dz[k] = q.dz[i];
+		}
+		renderer.camera.skyCube.Lookup8(dx, dy, dz, r, g, b);
+		for (int k = 0; k < count; k++)
+		{
+			const int i = localMisses[m + k];
+			const float3 throughput{ q.tr[i], q.tg[i], q.tb[i] };
+			radiance[q.path[i]] += throughput * float3(r[k], g[k], b[k]) * renderer.SkyWeight(float3(dx[k], dy[k], dz[k]), q.pdf[i]);
+		}
+	}
+
+	// Flush the shadow rays; every path's rays stay contiguous
+	const int shadowBase = shadows.Reserve((int)localShadows.size());
+	for (int i = first; i < last; i++) q.shadowStart[i] += shadowBase;
+	for (size_t s = 0; s < localShadows.size(); s++)
+	{
+		const ShadowSample& sample = localShadows[s];
+		const int j = shadowBase + (int)s;
+		shadows.ox[j] = sample.origin.x, shadows.oy[j] = sample.origin.y, shadows.oz[j] = sample.origin.z;
+		shadows.dx[j] = sample.direction.x, shadows.dy[j] = sample.direction.y, shadows.dz[j] = sample.direction.z;
+		shadows.dist[j] = sample.distance;
+		shadows.cr[j] = sample.contribution.x, shadows.cg[j] = sample.contribution.y, shadows.cb[j] = sample.contribution.z;
+	}
+
+	// Flush the continuation rays into the next bounce's queue
+	const int nextBase = next.Reserve((int)localBounces.size());
+	for (size_t b = 0; b < localBounces.size(); b++)
+	{
+		const tinybvh::Ray& bounce = localBounces[b].second;
+		const int j = nextBase + (int)b;
+		next.ox[j] = bounce.O.x, next.oy[j] = bounce.O.y, next.oz[j] = bounce.O.z;
+		next.dx[j] = bounce.D.x, next.dy[j] = bounce.D.y, next.dz[j] = bounce.D.z;
+		next.tr[j] = localThroughput[b].x, next.tg[j] = localThroughput[b].y, next.tb[j] = localThroughput[b].z;
+		next.pdf[j] = localPdf[b];
+		next.coneWidth[j] = localCones[b].x, next.coneSpread[j] = localCones[b].y;
+		next.path[j] = localBounces[b].first;
+	}
+}
+
+void Wavefront::Connect(Tmpl8::Renderer& renderer, const int first, const int last)
+{
+	// Iterating the path queue keeps the radiance writes race free: one queue entry per path
+	PathQueue& q = queues[current];
+	for (int i = first; i < last; i++)
+	{
+		const int end = q.shadowStart[i] + q.shadowCount[i];
+		for (int j = q.shadowStart[i]; j < end; j++)
+		{
+			tinybvh::Ray shadowRay(float3{ shadows.ox[j], shadows.oy[j], shadows.oz[j] }, float3{ shadows.dx[j], shadows.dy[j], shadows.dz[j] }, shadows.dist[j]);
+			if (!renderer.scene.IsOccluded(shadowRay))
+				radiance[q.path[i]] += float3{ shadows.cr[j], shadows.cg[j], shadows.cb[j] };
+		}
+	}
+}
+
+void Wavefront::Resolve(Tmpl8::Renderer& renderer, const Tile& tile)
+{
+	const float scale = 1.f / samples;
+	for (int y = tile.y0; y < tile.y1; y++)
+		for (int x = tile.x0; x < tile.x1; x++)
+		{
+			const int pixel = x + y * renderer.renderWidth;
+			float3 traceResult{ 0.f };
+			for (int s = 0; s < samples; s++) traceResult += radiance[pixel * samples + s];
+			renderer.StorePixel(renderer.ScreenX(x), renderer.ScreenY(y), traceResult * scale, primaryDistance[pixel], samples);
+		}
+}
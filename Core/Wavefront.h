@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+
+namespace Tmpl8
+{
+class Renderer;
+}
+
+// Structure-of-arrays queue of path segments, one entry per live path
+struct PathQueue
+{
+	std::vector<float> ox, oy, oz; // ray origin
+	std::vector<float> dx, dy, dz; // ray direction
+	std::vector<float> tr, tg, tb; // path throughput
+	std::vector<float> pdf; // of the bounce that started the segment, 0 for camera rays and delta bounces
+	std::vector<float> coneWidth, coneSpread; // ray cone at the origin, for texture LOD
+	std::vector<int> path; // index into the per-sample radiance
+	std::vector<float> t, u, v; // hit record, filled in by the extend stage
+	std::vector<uint> inst, prim;
+	std::vector<int> shadowStart, shadowCount; // shadow rays pushed by the shade stage
+	std::atomic<int> count{ 0 };
+
+	void Resize(const int capacity);
+	int Reserve(const int entries) { return count.fetch_add(entries); }
+};
+
+// Structure-of-arrays queue of shadow rays with the contribution they carry when unoccluded
+struct ShadowQueue
+{
+	std::vector<float> ox, oy, oz;
+	std::vector<float> dx, dy, dz;
+	std::vector<float> dist;
+	std::vector<float> cr, cg, cb;
+	std::atomic<int> count{ 0 };
+
+	void Resize(const int capacity);
+	// Sized for HITSHADOWSAMPLES per path, a hit that records more would write past the end
+	int Reserve(const int entries)
+	{
+		const int base = count.fetch_add(entries);
+		assert(base + entries <= (int)ox.size());
+		return base;
+	}
+};
+
+// Stream path tracer: instead of following one path per pixel to the end, every bounce runs
+// as separate passes over all live paths. Generate creates the camera rays, Extend traces them
+// against the TLAS, Shade evaluates the materials and queues shadow rays and continuation rays,
+// Connect traces the shadow rays. Each pass is a tight loop over one kind of work.
+class Wavefront
+{
+public:
+	int batchSize = 1024; // queue entries per scheduler job
+	float stageTime[4] = {}; // ms spent in generate, extend, shade and connect during the last frame
+
+	void Render(Tmpl8::Renderer& renderer);
+
+private:
+	void Generate(Tmpl8::Renderer& renderer, const int first, const int last);
+	void Extend(Tmpl8::Renderer& renderer, const int first, const int last);
+	void Shade(Tmpl8::Renderer& renderer, const int depth, const int first, const int last);
+	void Connect(Tmpl8::Renderer& renderer, const int first, const int last);
+	void Resolve(Tmpl8::Renderer& renderer, const Tile& tile);
+
+	PathQueue queues[2]; // current and next bounce
+	ShadowQueue shadows;
+	int current = 0;
+	int samples = 1; // paths per pixel
+	std::vector<float3> radiance; // per path
+	std::vector<float> primaryDistance; // per render pixel, hit distance of the first sample
+};
@@ -15,6 +15,7 @@ constexpr int SCRHEIGHT = 270;
 constexpr int UPSCALE = 3;
 
 constexpr int POINTLIGHTS = 4;
+constexpr int PACKETSIZE = 16; // Primary ray packets cover PACKETSIZE x PACKETSIZE pixels (tinybvh 256-ray packets)
 constexpr int WIDTHXHEIGHT = 921600;
 constexpr float GRAVITY = -9.81;
 constexpr double PI = 3.14159265358979323846264f;
@@ -0,0 +1,403 @@
+#include "precomp.h"
+
+#ifdef HEADLESS
+// Headless entry point for render nodes without a GPU or display.
+// Loads the scene, accumulates a fixed number of frames and writes the result to disk.
+// Usage: Core -frames 64 -spp 2 -bounces 4 -tile 16 -threads 32 [-wavefront] -o render.hdr
+// A .hdr output stores the linear accumulator average, anything else is written as PNG.
+
+// static member data for instruction set support class
+static const CPUCaps cpucaps;
+
+// there is no window, so no focus and no keys
+bool WindowHasFocus() { return false; }
+bool IsKeyDown( const uint key ) { UNREFERENCED_PARAMETER( key ); return false; }
+
+void FatalError( const char* fmt, ... )
+{
+	va_list args;
+	va_start( args, fmt );
+	vfprintf( stderr, fmt, args );
+	va_end( args );
+	exit( 1 );
+}
+
+// Every accumulator layout on the same synthetic frames: the bytes one frame of updates reads and
+// writes, and the time the updates take on one thread
+static void BenchmarkAccumulators( const int pixels )
+{
+	printf( "accumulator layouts at %i pixels:\n", pixels );
+	const AccumulatorFormat formats[] = { AccumulatorFormat::FLOAT4, AccumulatorFormat::FLOAT3, AccumulatorFormat::HALF, AccumulatorFormat::RGB9E5 };
+	const int frames = 8;
+	for (const AccumulatorFormat format : formats)
+	{
+		Accumulator accumulator;
+		accumulator.Resize( pixels, format );
+		Timer timer;
+		for (int frame = 0; frame < frames; frame++)
+			for (int i = 0; i < pixels; i++) accumulator.Add( i, float3( (i & 255) * (1.0f / 255), (frame + 1) * 0.1f, 0.5f ) );
+		const float ms = timer.elapsed() * 1000.0f / frames;
+		const float megabytes = 2.0f * pixels * accumulator.BytesPerPixel() / 1000000.0f; // read and write
+		printf( "  %-12s %2i B/pixel, %7.1f MB touched per frame, %6.2f ms per frame\n", Accumulator::FormatName( format ), accumulator.BytesPerPixel(), megabytes, ms );
+	}
+}
+
+// Point lights of random colors spread uniformly through a box, their total intensity does not depend on their count
+static vector<TreeLight> ScatterBulbs( const int count, const float3& boundsMin, const float3& boundsMax, uint& seed )
+{
+	vector<TreeLight> bulbs( count );
+	const float3 extent = boundsMax - boundsMin;
+	for (TreeLight& bulb : bulbs)
+	{
+		bulb.position = boundsMin + extent * float3( RandomFloat( seed ), RandomFloat( seed ), RandomFloat( seed ) );
+		bulb.color = float3( RandomFloat( seed ), RandomFloat( seed ), RandomFloat( seed ) ) * (256.0f / count);
+	}
+	return bulbs;
+}
+
+// The light tree against evaluating every light, from 4 to 10k bulbs: the time a shading point takes to pick
+// and evaluate one light through the tree or to sum all of them, one at a time and with the SIMD kernels of
+// every instruction set the CPU supports, and the ratio of the tree's and the sum's means
+static void BenchmarkLightTree()
+{
+	printf( "light sampling per shading point:\n" );
+	const int counts[] = { 4, 16, 64, 256, 1024, 4096, 10000 };
+	const int points = 100000;
+	const float3 boundsMin( -10.0f ), boundsMax( 10.0f );
+	uint seed = 0x2545f491;
+	vector<float3> positions( points ), normals( points );
+	vector<float> randoms( points );
+	for (int i = 0; i < points; i++)
+	{
+		positions[i] = boundsMin + (boundsMax - boundsMin) * float3( RandomFloat( seed ), RandomFloat( seed ), RandomFloat( seed ) );
+		normals[i] = normalize( float3( RandomFloat( seed ), RandomFloat( seed ), RandomFloat( seed ) ) * 2.0f - 1.0f );
+		randoms[i] = RandomFloat( seed );
+	}
+	for (const int count : counts)
+	{
+		const vector<TreeLight> lights = ScatterBulbs( count, boundsMin, boundsMax, seed );
+		LightTree tree;
+		Timer timer;
+		tree.Build( lights );
+		const float buildMs = timer.elapsed() * 1000.0f;
+
+		// Summing every light is only timed on as many points as keep it to a few million evaluations
+		const int allPoints = min( points, max( 1000, 4000000 / count ) );
+		float3 L;
+		float distance, treeMean = 0, allMean = 0;
+		timer.reset();
+		for (int i = 0; i < points; i++)
+		{
+			float pmf;
+			const int light = tree.Sample( positions[i], normals[i], randoms[i], pmf );
+			if (light < 0) continue;
+			const float3 estimate = LightTree::Incident( tree.Light( light ), positions[i], normals[i], L, distance ) / pmf;
+			if (i < allPoints) treeMean += (estimate.x + estimate.y + estimate.z) / allPoints;
+		}
+		const float treeNs = timer.elapsed() * 1e9f / points;
+		timer.reset();
+		for (int i = 0; i < allPoints; i++)
+		{
+			float3 sum( 0 );
+			for (int light = 0; light < tree.Size(); light++) sum += LightTree::Incident( tree.Light( light ), positions[i], normals[i], L, distance );
+			allMean += (sum.x + sum.y + sum.z) / allPoints;
+		}
+		const float allNs = timer.elapsed() * 1e9f / allPoints;
+		printf( "  %5i lights: %5i nodes, build %7.3f ms, tree %7.1f ns, means %.3f; all lights: scalar %10.1f ns", count, tree.Nodes(), buildMs, treeNs, allMean > 0 ? treeMean / allMean : 0.0f, allNs );
+
+		SimdLights simdLights;
+		simdLights.Assign( lights.data(), count );
+		const SimdIsa selected = SimdLights::Selected();
+		for (const SimdIsa isa : { SimdIsa::SSE4, SimdIsa::AVX2, SimdIsa::AVX512 })
+		{
+			if (!SimdLights::Supported( isa )) continue;
+			SimdLights::Select( isa );
+			float3 sum( 0 );
+			timer.reset();
+			for (int i = 0; i < allPoints; i++) sum += simdLights.Sum( positions[i], normals[i] );
+			printf( ", %s %9.1f ns", SimdLights::IsaName( isa ), timer.elapsed() * 1e9f / allPoints );
+			if (sum.x < 0) printf( "!" ); // keeps the sum alive
+		}
+		SimdLights::Select( selected );
+		printf( "\n" );
+	}
+}
+
+// Texel fetches per second from the top level of a 2048x2048 texture in every layout, for uv spread over the
+// whole texture and for uv clustered around random centres, the way neighbouring rays hit a surface
+static void BenchmarkTextures()
+{
+	printf( "texture fetches, 2048x2048:\n" );
+	const int size = 2048, fetches = 1 << 22, cluster = 64;
+	uint seed = 0x6c8e9cf5;
+	Surface texture( size, size );
+	for (int i = 0; i < size * size; i++) texture.pixels[i] = RandomUInt( seed );
+	vector<float2> spread( fetches ), clustered( fetches );
+	for (int i = 0; i < fetches; i++) spread[i] = float2( RandomFloat( seed ), RandomFloat( seed ) );
+	for (int i = 0; i < fetches; i += cluster)
+	{
+		const float2 centre( RandomFloat( seed ), RandomFloat( seed ) );
+		for (int j = 0; j < cluster; j++) clustered[i + j] = centre + (float2( RandomFloat( seed ), RandomFloat( seed ) ) - 0.5f) * (16.0f / size);
+	}
+	const TextureLayout selected = MipChain::layout;
+	const TextureFormat selectedFormat = MipChain::formats[(int)TextureMap::ALBEDO];
+	MipChain::formats[(int)TextureMap::ALBEDO] = TextureFormat::RGBA8;
+	for (const TextureLayout layout : { TextureLayout::LINEAR, TextureLayout::TILED })
+	{
+		MipChain::layout = layout;
+		MipChain chain;
+		chain.Build( &texture, TextureMap::ALBEDO );
+		printf( "  %-6s", MipChain::LayoutName( layout ) );
+		for (const vector<float2>* uvs : { &spread, &clustered })
+		{
+			uint sum = 0;
+			Timer timer;
+			for (const float2& uv : *uvs) sum += chain.Texel( uv, 0 );
+			printf( " %s %8.1f Mfetch/s", uvs == &spread ? "spread" : "clustered", fetches / (timer.elapsed() * 1e6f) );
+			if (sum == 0) printf( "!" ); // keeps the sum alive
+		}
+		printf( "\n" );
+	}
+	MipChain::layout = selected;
+	MipChain::formats[(int)TextureMap::ALBEDO] = selectedFormat;
+
+	// Decoding a compressed texel, from the same uv as above; BC4 keeps red, BC5 red and green
+	for (const TextureFormat format : { TextureFormat::BC1, TextureFormat::BC4, TextureFormat::BC5 })
+	{
+		BlockTexture blocks;
+		Timer timer;
+		blocks.Encode( texture.pixels, size, size, format );
+		printf( "  %-6s encode %7.1f ms, %5.2f B/texel", BlockTexture::FormatName( format ), timer.elapsed() * 1000.0f, (float)blocks.Bytes() / (size * size) );
+		for (const vector<float2>* uvs : { &spread, &clustered })
+		{
+			uint sum = 0;
+			timer.reset();
+			for (const float2& uv : *uvs)
+			{
+				const int x = (int)(uv.x * size) & (size - 1), y = (int)(uv.y * size) & (size - 1);
+				sum += blocks.Texel( x, y );
+			}
+			printf( " %s %8.1f Mfetch/s", uvs == &spread ? "spread" : "clustered", fetches / (timer.elapsed() * 1e6f) );
+			if (sum == 0) printf( "!" ); // keeps the sum alive
+		}
+		printf( "\n" );
+	}
+}
+
+static void PrintUsage()
+{
+	printf( "usage: Core [-frames N] [-resolution WxH] [-spp N] [-bounces N] [-tile N] [-threads N] [-nopackets] [-nodefer] [-wavefront] [-adaptive threshold] [-denoise iterations] [-accumulator float4|float3|half|rgb9e5] [-sampler random|sobol] [-seed N] [-mis off|balance|power] [-nolighttree] [-lights N] [-restir] [-notexturelod] [-texturelayout linear|tiled] [-texformat albedo|normal|rma|emission:rgba8|bc1|bc5] [-isa sse4|avx2|avx512] [-verify] [-gamma] [-o file.hdr|file.png]\n" );
+	printf( "       Core --bench all|accum,lights,textures [-resolution WxH] [-isa ...] [-texturelayout ...]: runs the benchmarks instead of rendering\n" );
+}
+
+int main( int argc, char** argv )
+{
+	int frames = 16, spp = 2, bounces = 2, tileSize = 16, threads = 0, denoise = 0;
+	int width = SCRWIDTH, height = SCRHEIGHT;
+	float adaptive = 0;
+	int bulbs = 0;
+	bool gamma = false, wavefront = false, packets = true, defer = true, verify = false, lighttree = true, restir = false, texturelod = true;
+	bool accumbench = false, lightbench = false, texbench = false; // --bench, run instead of a render
+	AccumulatorFormat accumulatorFormat = AccumulatorFormat::FLOAT4;
+	SamplerType samplerType = SamplerType::SOBOL;
+	uint seed = 0;
+	Renderer::MIS_HEURISTIC misHeuristic = Renderer::MIS_HEURISTIC::POWER;
+	string outFile = "render.hdr";
+	for (int i = 1; i < argc; i++)
+	{
+		const string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "-frames" && hasValue) frames = max( 1, atoi( argv[++i] ) );
+		else if (arg == "-spp" && hasValue) spp = max( 1, atoi( argv[++i] ) );
+		else if (arg == "-bounces" && hasValue) bounces = max( 1, atoi( argv[++i] ) );
+		else if (arg == "-tile" && hasValue) tileSize = max( 4, atoi( argv[++i] ) );
+		else if (arg == "-threads" && hasValue) threads = max( 0, atoi( argv[++i] ) );
+		else if (arg == "-resolution" && hasValue)
+		{
+			if (sscanf( argv[++i], "%ix%i", &width, &height ) != 2 || width < 1 || height < 1) { PrintUsage(); return 1; }
+		}
+		else if (arg == "-o" && hasValue) outFile = argv[++i];
+		else if (arg == "-gamma") gamma = true;
+		else if (arg == "-wavefront") wavefront = true;
+		else if (arg == "-nopackets") packets = false;
+		else if (arg == "-nodefer") defer = false;
+		else if (arg == "-adaptive" && hasValue) adaptive = max( 0.f, (float)atof( argv[++i] ) );
+		else if (arg == "-denoise" && hasValue) denoise = max( 0, atoi( argv[++i] ) );
+		else if (arg == "-accumulator" && hasValue)
+		{
+			const string format = argv[++i];
+			if (format == "float4") accumulatorFormat = AccumulatorFormat::FLOAT4;
+			else if (format == "float3") accumulatorFormat = AccumulatorFormat::FLOAT3;
+			else if (format == "half") accumulatorFormat = AccumulatorFormat::HALF;
+			else if (format == "rgb9e5") accumulatorFormat = AccumulatorFormat::RGB9E5;
+			else { PrintUsage(); return 1; }
+		}
+		else if (arg == "-sampler" && hasValue)
+		{
+			const string type = argv[++i];
+			if (type == "random") samplerType = SamplerType::RANDOM;
+			else if (type == "sobol") samplerType = SamplerType::SOBOL;
+			else { PrintUsage(); return 1; }
+		}
+		else if (arg == "-mis" && hasValue)
+		{
+			const string heuristic = argv[++i];
+			if (heuristic == "off") misHeuristic = Renderer::MIS_HEURISTIC::OFF;
+			else if (heuristic == "balance") misHeuristic = Renderer::MIS_HEURISTIC::BALANCE;
+			else if (heuristic == "power") misHeuristic = Renderer::MIS_HEURISTIC::POWER;
+			else { PrintUsage(); return 1; }
+		}
+		else if (arg == "-seed" && hasValue) seed = (uint)strtoul( argv[++i], nullptr, 10 );
+		else if (arg == "-verify") verify = true;
+		else if (arg == "-nolighttree") lighttree = false;
+		else if (arg == "-restir") restir = true;
+		else if (arg == "-notexturelod") texturelod = false;
+		else if (arg == "-lights" && hasValue) bulbs = max( 0, atoi( argv[++i] ) );
+		else if (arg == "--bench" && hasValue)
+		{
+			// Comma separated, the benchmarks run instead of a render
+			const string list = string( "," ) + argv[++i] + ",";
+			const bool all = list == ",all,";
+			accumbench = all || list.find( ",accum," ) != string::npos;
+			lightbench = all || list.find( ",lights," ) != string::npos;
+			texbench = all || list.find( ",textures," ) != string::npos;
+			if (!accumbench && !lightbench && !texbench) { PrintUsage(); return 1; }
+		}
+		else if (arg == "-texturelayout" && hasValue)
+		{
+			const string layout = argv[++i];
+			if (layout == "linear") MipChain::layout = TextureLayout::LINEAR;
+			else if (layout == "tiled") MipChain::layout = TextureLayout::TILED;
+			else { PrintUsage(); return 1; }
+		}
+		else if (arg == "-texformat" && hasValue)
+		{
+			const string setting = argv[++i];
+			const size_t colon = setting.find( ':' );
+			const string mapName = setting.substr( 0, colon ), formatName = colon == string::npos ? "" : setting.substr( colon + 1 );
+			const char* mapNames[] = { "albedo", "normal", "rma", "emission" };
+			int map = 0;
+			while (map < (int)TextureMap::MAPS && mapName != mapNames[map]) map++;
+			int format = 0;
+			while (format <= (int)TextureFormat::BC5 && formatName != BlockTexture::FormatName( (TextureFormat)format )) format++;
+			if (map == (int)TextureMap::MAPS || format > (int)TextureFormat::BC5 || !MipChain::Supports( (TextureMap)map, (TextureFormat)format )) { PrintUsage(); return 1; }
+			MipChain::formats[map] = (TextureFormat)format;
+		}
+		else if (arg == "-isa" && hasValue)
+		{
+			const string isa = argv[++i];
+			if (isa == "sse4") SimdLights::Select( SimdIsa::SSE4 );
+			else if (isa == "avx2") SimdLights::Select( SimdIsa::AVX2 );
+			else if (isa == "avx512") SimdLights::Select( SimdIsa::AVX512 );
+			else { PrintUsage(); return 1; }
+		}
+		else { PrintUsage(); return 1; }
+	}
+	if (accumbench || lightbench || texbench)
+	{
+		if (accumbench) BenchmarkAccumulators( width * height );
+		if (lightbench) BenchmarkLightTree();
+		if (texbench) BenchmarkTextures();
+		return 0;
+	}
+	const bool hdrOutput = outFile.size() > 4 && outFile.compare( outFile.size() - 4, 4, ".hdr" ) == 0;
+
+	// initialize application; scene and camera are loaded by the Renderer instance
+	TheApp::running = true;
+	Renderer* renderer = Renderer::getInstance();
+	renderer->screen = new Surface( width, height );
+	renderer->Init();
+	renderer->accumulates = true;
+	renderer->AA = spp > 1;
+	renderer->spp = spp;
+	renderer->bounces = bounces;
+	renderer->scheduler.tileSize = tileSize;
+	renderer->scheduler.threadCount = threads;
+	renderer->WAVEFRONT = wavefront;
+	renderer->PACKETS = packets;
+	renderer->DEFERSHADOWS = defer;
+	renderer->ADAPTIVE = adaptive > 0;
+	if (adaptive > 0) renderer->adaptiveThreshold = adaptive;
+	renderer->DENOISE = denoise > 0;
+	if (denoise > 0) renderer->denoiser.iterations = denoise;
+	renderer->GAMMACORRECTED = gamma || !hdrOutput; // the .hdr accumulator is always linear, gamma only affects the PNG
+	renderer->VERIFYACCUMULATOR = verify;
+	renderer->sampler.type = samplerType;
+	renderer->sampler.seed = seed;
+	renderer->misHeuristic = misHeuristic;
+	renderer->LIGHTTREE = lighttree;
+	renderer->RESTIR = restir;
+	renderer->TEXTURELOD = texturelod;
+	if (bulbs > 0)
+	{
+		// Synthetic bulbs through the scene's bounds, they only light it through the tree
+		uint bulbSeed = seed + 1;
+		renderer->bulbs = ScatterBulbs( bulbs, renderer->scene.tlas.aabbMin, renderer->scene.tlas.aabbMax, bulbSeed );
+	}
+	renderer->SetAccumulatorFormat( accumulatorFormat );
+
+	printf( "rendering %i frames at %ix%i, %i spp, %i bounces, %s sampler, %s light kernels%s\n", frames, width, height, spp, bounces, Sampler::TypeName( samplerType ), SimdLights::IsaName( SimdLights::Selected() ), wavefront ? ", wavefront" : "" );
+	float deltaTime = 0;
+	Timer total, timer;
+	vector<WorkerStats> threadTotals;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		timer.reset();
+		renderer->Tick( deltaTime );
+		deltaTime = 1000.0f * timer.elapsed();
+		printf( "frame %i/%i: %5.2f ms\n", frame + 1, frames, deltaTime );
+
+		const vector<WorkerStats>& stats = renderer->scheduler.stats;
+		threadTotals.resize( stats.size() );
+		for (size_t i = 0; i < stats.size(); i++)
+		{
+			threadTotals[i].busy += stats[i].busy, threadTotals[i].idle += stats[i].idle;
+			threadTotals[i].tiles += stats[i].tiles, threadTotals[i].stolen += stats[i].stolen;
+		}
+	}
+	const float seconds = total.elapsed();
+	const float primaryRays = (float)width * height * spp * frames;
+	printf( "done in %.2f s, %.2f primary Mrays/s\n", seconds, primaryRays / (seconds * 1000000.0f) );
+	if (adaptive > 0)
+	{
+		// Adaptive sampling spends the samples unevenly, report what ended up in the accumulator
+		float samples = 0;
+		for (int i = 0; i < width * height; i++) samples += renderer->samplesTaken[i];
+		printf( "adaptive: %.1f samples per pixel on average (%i at the regular rate)\n", samples / (width * height), spp * frames );
+	}
+	printf( "accumulator: %s, %i B/pixel\n", Accumulator::FormatName( accumulatorFormat ), renderer->accumulator.BytesPerPixel() );
+	size_t textureBytes, uncompressedBytes;
+	renderer->scene.TextureMemory( textureBytes, uncompressedBytes );
+	printf( "textures: %.1f MB, %.1f MB as rgba8\n", textureBytes / 1048576.0, uncompressedBytes / 1048576.0 );
+	if (verify)
+	{
+		// The float reference was fed the same frames, so any difference is the packed format's rounding
+		double squaredError = 0, squaredReference = 0;
+		float maxError = 0;
+		for (int i = 0; i < width * height; i++)
+		{
+			const float4 packed = renderer->accumulator.Average( i ), reference = renderer->referenceAccumulator.Average( i );
+			const float3 error( packed.x - reference.x, packed.y - reference.y, packed.z - reference.z );
+			squaredError += dot( error, error );
+			squaredReference += reference.x * reference.x + reference.y * reference.y + reference.z * reference.z;
+			maxError = max( maxError, max( fabsf( error.x ), max( fabsf( error.y ), fabsf( error.z ) ) ) );
+		}
+		const double rmse = sqrt( squaredError / (3.0 * width * height) ), rms = sqrt( squaredReference / (3.0 * width * height) );
+		printf( "verify: RMSE %.6f against float (%.4f%% of the RMS value), max error %.5f\n", rmse, rms > 0 ? 100.0 * rmse / rms : 0.0, maxError );
+	}
+	for (size_t i = 0; i < threadTotals.size(); i++)
+	{
+		const WorkerStats& t = threadTotals[i];
+		const float load = t.busy + t.idle > 0 ? 100.0f * t.busy / (t.busy + t.idle) : 0;
+		printf( "thread %2zu: busy %8.2f ms, idle %8.2f ms (%5.1f%% load), %i tiles, %i stolen\n", i, t.busy, t.idle, load, t.tiles, t.stolen );
+	}
+
+	if (hdrOutput) renderer->SaveAccumulator( outFile.c_str() );
+	else renderer->SaveScreen( outFile.c_str() );
+	printf( "saved %s\n", outFile.c_str() );
+
+	renderer->Shutdown();
+	return 0;
+}
+
+#endif // HEADLESS
@@ -0,0 +1,38 @@
+// Headless build support
+// Stands in for the few windows.h and GLFW symbols the renderer core relies on, so the
+// tracer can be compiled without a window, an OpenGL context or the Win32 API.
+// Enable by defining HEADLESS for every translation unit; the entry point then lives
+// in headless.cpp instead of template.cpp.
+
+#pragma once
+
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+
+#ifndef UNREFERENCED_PARAMETER
+#define UNREFERENCED_PARAMETER( P ) ( (void)( P ) )
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DebugBreak() __debugbreak()
+#else
+#define DebugBreak() raise( SIGTRAP )
+#endif
+
+// GLFW key codes used by Camera::HandleInput and the Renderer key handlers
+#define GLFW_KEY_SPACE	32
+#define GLFW_KEY_A		65
+#define GLFW_KEY_D		68
+#define GLFW_KEY_F		70
+#define GLFW_KEY_R		82
+#define GLFW_KEY_S		83
+#define GLFW_KEY_W		87
+#define GLFW_KEY_RIGHT	262
+#define GLFW_KEY_LEFT	263
+#define GLFW_KEY_DOWN	264
+#define GLFW_KEY_UP		265
+
+// there is no window: input queries always report 'nothing happened'
+bool WindowHasFocus();
@@ -4,6 +4,7 @@
 
 #include "precomp.h"
 
+#ifndef HEADLESS
 extern bool IGP_detected;
 
 void FatalError( const char* fmt, ... )
@@ -259,4 +260,6 @@ void Shader::SetUInt( const char* name, const uint v )
 {
 	glUniform1ui( glGetUniformLocation( ID, name ), v );
 	CheckGL();
-}
\ No newline at end of file
+}
+
+#endif // HEADLESS
@@ -14,6 +14,7 @@
 #include <list>					// standard template library std::list
 #include <algorithm>			// standard algorithms for stl containers
 #include <string>				// strings
+#include <cstring>				// memset, memcpy
 // #include <thread>			// currently unused; enable to use Windows threads.
 #include <math.h>				// c standard math library
 #include <assert.h>				// runtime assertions
@@ -64,6 +65,10 @@ using namespace Tmpl8;
 
 // clang-format off
 
+#ifdef HEADLESS
+// headless builds (render nodes): no window, no OpenGL context, no Win32.
+#include "headless.h"
+#else
 // windows.h: disable a few things to speed up compilation.
 #define NOMINMAX
 #ifndef WIN32_LEAN_AND_MEAN
@@ -107,6 +112,7 @@ using namespace Tmpl8;
 #define NOMCX
 #define NOIME
 #include "windows.h"
+#endif
 
 // cross-platform directory access
 #ifdef _MSC_VER
@@ -117,6 +123,7 @@ using namespace Tmpl8;
 #include <unistd.h>
 #endif
 
+#ifndef HEADLESS
 // imgui
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -135,6 +142,7 @@ using namespace Tmpl8;
 
 // opencl & opencl
 #include "opengl.h"
+#endif
 
 // fatal error reporting (with a pretty window)
 #define FATALERROR( fmt, ... ) FatalError( "Error on line %d of %s: " fmt "\n", __LINE__, __FILE__, ##__VA_ARGS__ )
@@ -156,6 +164,7 @@ struct Timer
 	chrono::high_resolution_clock::time_point start;
 };
 
+#ifndef HEADLESS
 // Nils's jobmanager
 class Job
 {
@@ -198,6 +207,7 @@ protected:
 	unsigned int m_NumThreads, m_JobCount;
 	JobThread* m_JobThreadList;
 };
+#endif
 
 // forward declaration of helper functions
 void FatalError( const char* fmt, ... );
@@ -217,7 +227,7 @@ void TextFileWrite( const string& text, const char* _File );
 #define cpuid(info, x) __cpuidex(info, x, 0)
 #else
 #include <cpuid.h>
-void cpuid( int info[4], int InfoType ) { __cpuid_count( InfoType, 0, info[0], info[1], info[2], info[3] ); }
+inline void cpuid( int info[4], int InfoType ) { __cpuid_count( InfoType, 0, info[0], info[1], info[2], info[3] ); }
 #endif
 class CPUCaps // from https://github.com/Mysticial/FeatureDetector
 {
@@ -338,8 +348,8 @@ public:
 
 bool IsKeyDown( const uint key );
 
-#include "scene.h"
-#include "camera.h"
-#include "renderer.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "Renderer.h"
 
 // EOF
\ No newline at end of file
@@ -33,14 +33,22 @@ Surface::Surface( const char* file ) : pixels( 0 ), width( 0 ), height( 0 )
 
 void Surface::CopyHalfSize(Surface* a_Dst)
 {
+	// Averages every 2x2 block, all four channels so alpha survives; an odd last row or column is dropped
 	uint* dst = a_Dst->pixels;
-	uint* src = pixels;
 	const int w = width / 2, h = height / 2;
-	for (int y = 0; y < h; y++, src += width) for (int x = 0; x < w; x++, src += 2, dst++)
+	for (int y = 0; y < h; y++)
 	{
-		uint p1 = ((src[0] >> 1) & 0x7f7f7f) + ((src[1] >> 1) & 0x7f7f7f);
-		uint p2 = ((src[width] >> 1) & 0x7f7f7f) + ((src[width + 1] >> 1) & 0x7f7f7f);
-		dst[0] = ((p1 >> 1) & 0x7f7f7f) + ((p2 >> 1) & 0x7f7f7f);
+		const uint* src = pixels + y * 2 * width;
+		for (int x = 0; x < w; x++, src += 2, dst++)
+		{
+			uint result = 0;
+			for (int shift = 0; shift < 32; shift += 8)
+			{
+				const uint sum = ((src[0] >> shift) & 255) + ((src[1] >> shift) & 255) + ((src[width] >> shift) & 255) + ((src[width + 1] >> shift) & 255);
+				result |= ((sum + 2) >> 2) << shift;
+			}
+			dst[0] = result;
+		}
 	}
 }
 
@@ -1,5 +1,6 @@
 #include "precomp.h"
 
+#ifndef HEADLESS
 #pragma comment( linker, "/subsystem:windows /ENTRY:mainCRTStartup" )
 using namespace Tmpl8;
 
@@ -179,6 +180,12 @@ void main()
 		deltaTime = min( 500.0f, 1000.0f * timer.elapsed() );
 		timer.reset();
 		app->Tick( deltaTime );
+		// the renderer may have changed its resolution, the quad stretches any size over the window
+		if (app->screen && ((int)renderTarget->width != app->screen->width || (int)renderTarget->height != app->screen->height))
+		{
+			delete renderTarget;
+			InitRenderTarget( app->screen->width, app->screen->height );
+		}
 		// send the rendering result to the screen using OpenGL
 		if (frameNr++ > 1)
 		{
@@ -1567,4 +1574,6 @@ extern "C" {
 }
 #endif
 
-// EOF
\ No newline at end of file
+// EOF
+
+#endif // HEADLESS
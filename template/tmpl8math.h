@@ -14,11 +14,11 @@ namespace Tmpl8
 #pragma warning ( disable: 4201 /* nameless struct / union */ )
 
 // Color Casting
-uint MakeColor(float A, float R, float G, float B)
+inline uint MakeColor(float A, float R, float G, float B)
 {
 	return (static_cast<uint>(A) << 24 | static_cast<uint>(R) << 16 | static_cast<uint>(G) << 8 | static_cast<uint>(B) << 0);
 };
-uint MakeColor(int A, int R, int G, int B)
+inline uint MakeColor(int A, int R, int G, int B)
 {
 	return (static_cast<uint>(A * 255) << 24 | static_cast<uint>(R * 255) << 16 | static_cast<uint>(G * 255) << 8 | static_cast<uint>(B * 255.f) << 0);
 };
@@ -560,7 +560,7 @@ public:
 	mat2( float2 a, float2 b ) { cell[0] = a.x, cell[1] = b.x, cell[2] = a.y, cell[3] = b.y; }
 	// mat2( float2 a, float2 b ) { cell[0] = a.x, cell[1] = a.y, cell[2] = b.x, cell[3] = b.y; }
 	mat2( float a, float b, float c, float d ) { cell[0] = a, cell[1] = b, cell[2] = c, cell[3] = d; }
-	__declspec(align(16)) float cell[4] = { 1, 0, 0, 1 };
+	ALIGN( 16 ) float cell[4] = { 1, 0, 0, 1 };
 	constexpr static mat2 Identity() { return mat2{}; }
 	float operator()( const int i, const int j ) const { return cell[i * 2 + j]; }
 	float& operator()( const int i, const int j ) { return cell[i * 2 + j]; }
@@ -571,7 +571,7 @@ class mat4
 {
 public:
 	mat4() = default;
-	__declspec(align(64)) float cell[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+	ALIGN( 64 ) float cell[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
 	float& operator [] ( const int idx ) { return cell[idx]; }
 	float operator()( const int i, const int j ) const { return cell[i * 4 + j]; }
 	float& operator()( const int i, const int j ) { return cell[i * 4 + j]; }
@@ -970,8 +970,14 @@ public:
 	{
 		struct
 		{
+#ifdef _MSC_VER
 			union { __m128 bmin4; float bmin[4]; struct { float3 bmin3; }; };
 			union { __m128 bmax4; float bmax[4]; struct { float3 bmax3; }; };
+#else
+			// gcc rejects members with constructors in anonymous aggregates
+			union { __m128 bmin4; float bmin[4]; };
+			union { __m128 bmax4; float bmax[4]; };
+#endif
 		};
 		__m128 bounds[2] = { _mm_setr_ps( 1e34f, 1e34f, 1e34f, 0 ), _mm_setr_ps( -1e34f, -1e34f, -1e34f, 0 ) };
 	};
@@ -1029,7 +1035,8 @@ inline float3 cosineweighteddiffusereflection( const float3 N, uint& seed )
 float half_to_float( const half x );
 half float_to_half( const float x );
 
-// bad float detection (method from OpenCV)
+// bad float detection (method from OpenCV); glibc already provides these
+#ifdef _MSC_VER
 inline bool isnan( const float value )
 {
 	const uint ieee754 = *reinterpret_cast<const uint*>(&value);
@@ -1040,6 +1047,7 @@ inline bool isinf( const float value )
 	const uint ieee754 = *reinterpret_cast<const uint*>(&value);
 	return (ieee754 & 0x7fffffff) == 0x7f800000;
 }
+#endif
 inline bool badfloat( const float value )
 {
 	const uint ieee754 = *reinterpret_cast<const uint*>(&value);